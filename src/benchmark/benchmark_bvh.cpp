@@ -82,7 +82,9 @@ BENCHMARK(BM_BVH_Tracing_OMP_threadsNum_tileSize)->Unit(benchmark::kMillisecond)
 static void BM_BVH_Tracing_at_threadNum(benchmark::State &state)
 {
     ShapeDataIO io;
-    std::vector<Sphere *> sceneSpheres = io.load_scene("./random_spheres_scene.data");
+    // generated in memory so the benchmark does not depend on a scene file; the
+    // same layout as random_scene_*, so timings compare with the file based runs
+    std::vector<Sphere *> sceneSpheres = io.load_scene("gen:random_scene,size=11,seed=1");
 
     camera cam = camera::getDefault();
     // Image
@@ -9,6 +9,7 @@
 #include "boundable.h"
 #include <omp.h>
 #include "ray_tracing.h"
+#include "options.h"
 #include <benchmark/benchmark.h>
 
 static std::string sceneFile;
@@ -17,6 +18,7 @@ static traceConfig *pConfig;
 static BVH *pWorld;
 static double max_elapsed = DBL_MIN;
 static double* perCpuTime;
+static uint64_t* perRankBytes;
 static int nprocs = 0;
 
 namespace{
@@ -67,21 +69,18 @@ double raytracing(const traceConfig config, BVH &world)
   }
 
   MPI_Win window;
-  MPI_Datatype MPI_COLOR;
-  color *output_image = nullptr;
-  MPI_Alloc_mem(sizeof(color) * image_height * image_width,
+  const size_t pixel_size = wire_pixel_size(config.wire);
+  unsigned char *output_image = nullptr;
+  MPI_Alloc_mem(pixel_size * image_height * image_width,
                 MPI_INFO_NULL,
                 &output_image);
 
   MPI_Win_create(output_image,
-                 sizeof(color) * image_height * image_width,
-                 sizeof(color),
+                 pixel_size * image_height * image_width,
+                 1,
                  MPI_INFO_NULL, MPI_COMM_WORLD,
                  &window);
 
-  MPI_Type_contiguous(3, MPI_DOUBLE, &MPI_COLOR);
-  MPI_Type_commit(&MPI_COLOR);
-
   double tstart = omp_get_wtime();
   MPI_Win_fence(0, window);
 
@@ -101,7 +100,8 @@ double raytracing(const traceConfig config, BVH &world)
           ray r = cam.get_ray(u, v);
           pixel_color += ray_color(r, world, max_depth);
         }
-        output_image[((image_height - 1 - j) * image_width + i)] = pixel_color;
+        encode_wire_pixel(config.wire, pixel_color, samples_per_pixel,
+                          output_image + ((image_height - 1 - j) * image_width + i) * pixel_size);
       }
     }
   }
@@ -109,14 +109,16 @@ double raytracing(const traceConfig config, BVH &world)
   int offset_pixels = (image_height - my_row_start) * image_width;
   int num_pixels = (my_row_start - my_row_end) * image_width;
 
+  uint64_t bytes_sent = 0;
   if (config.myRank != 0)
   {
-    MPI_Put(output_image + offset_pixels,
-            num_pixels,
-            MPI_COLOR, 0,
-            offset_pixels,
-            num_pixels,
-            MPI_COLOR, window);
+    MPI_Put(output_image + offset_pixels * pixel_size,
+            num_pixels * pixel_size,
+            MPI_BYTE, 0,
+            offset_pixels * pixel_size,
+            num_pixels * pixel_size,
+            MPI_BYTE, window);
+    bytes_sent = num_pixels * pixel_size;
   }
 
   double tend = omp_get_wtime();
@@ -132,6 +134,14 @@ double raytracing(const traceConfig config, BVH &world)
              MPI_DOUBLE,
              0,
              MPI_COMM_WORLD);
+  MPI_Gather(&bytes_sent,
+             1,
+             MPI_UINT64_T,
+             perRankBytes,
+             1,
+             MPI_UINT64_T,
+             0,
+             MPI_COMM_WORLD);
 
   if (config.myRank == 0 && config.printOutput==true)
   {
@@ -141,10 +151,10 @@ double raytracing(const traceConfig config, BVH &world)
             << " to " << my_row_start << "\n";
     */
 
-    std ::cout << "P3\n"
-               << image_width << ' ' << image_height << "\n255\n";
-    for (int i = 0; i < image_height * image_width; i++)
-      write_color(std::cout, output_image[i], samples_per_pixel);
+    std::vector<color> sums(image_width * image_height);
+    for (int i = 0; i < image_width * image_height; i++)
+      sums[i] = decode_wire_pixel(config.wire, output_image + i * pixel_size, samples_per_pixel);
+    write_image(config.output, sums.data(), image_width, image_height, samples_per_pixel);
   }
 
   /*
@@ -161,7 +171,6 @@ double raytracing(const traceConfig config, BVH &world)
 
   MPI_Win_free(&window);
   MPI_Free_mem(output_image);
-  MPI_Type_free(&MPI_COLOR);
 
   return t_elapsed = tend - tstart;
 }
@@ -189,6 +198,8 @@ void mpi_benchmark(benchmark::State &state)
       snprintf(label,sizeof(label),"process%i",i);
       std::string slabel=label;
       state.counters[slabel] = perCpuTime[i];
+      snprintf(label,sizeof(label),"bytes%i",i);
+      state.counters[label] = perRankBytes[i];
     }
   }
 }
@@ -216,7 +227,7 @@ int main(int argc, char **argv)
 
   if (argc < 3)
   {
-    std::cerr << "Usage:" << argv[0] << " sceneFile num_threads" << std::endl;
+    std::cerr << "Usage:" << argv[0] << " sceneFile|gen:spec num_threads [--wire=float|half|rgbe]" << std::endl;
     exit(1);
   }
 
@@ -242,6 +253,8 @@ int main(int argc, char **argv)
 
   traceConfig config(cam, image_width, image_height, max_depth, samples_per_pixel, nprocs, my_rank, num_threads,false);
   pConfig = &config;
+  options opts(argc, argv);
+  wire_options(opts, config.wire);
 
   ::benchmark::Initialize(&argc, argv);
 
@@ -250,6 +263,7 @@ int main(int argc, char **argv)
   {
     std::cerr << "Rendering scene " << sceneFile << " using " << num_threads << " threads\n";
     perCpuTime = new double[nprocs];
+    perRankBytes = new uint64_t[nprocs];
     ::benchmark::RunSpecifiedBenchmarks();
   }
   else
@@ -261,6 +275,7 @@ int main(int argc, char **argv)
   if (my_rank == 0)
   {
     delete[] perCpuTime;
+    delete[] perRankBytes;
     std::cerr << "\nDone.\n";
   }
   MPI_Finalize();
@@ -24,7 +24,7 @@ void Extent::extendBy(const Extent* extents)
 
 // Here we are implementing the formular to calculate t the time a ray needs to hit a normal plane.
 // t_near = (d_near - N*O)/(N*R)
-bool Extent::interset(const double *numberator, const double *denominator, double &tNear, double &tFar, int &planeIndex)
+bool Extent::interset(const double *numberator, const double *denominator, double &tNear, double &tFar, int &planeIndex) const
 {
     for (int i = 0; i < kNumPlaneSetNormals; i++)
     {
@@ -76,9 +76,11 @@ void Sphere::calculateBounds(const vec3 normalPlanes[], const int planeSize, con
 }
 
 bool Sphere::hit(const ray& ray, const double t_min, const double t_max, hit_record &rec) const{
-    vec3 test2 = ray.origin();
-    vec3 test1 = this->center;
-   vec3 oc = ray.origin() - this->center;
+    return hit(center, r, mat_ptr, ray, t_min, t_max, rec);
+}
+
+bool Sphere::hit(const vec3 &center, double r, material *mat, const ray& ray, const double t_min, const double t_max, hit_record &rec){
+   vec3 oc = ray.origin() - center;
    auto a = ray.direction().length_squared();
    auto half_b = dot(oc, ray.direction());
    auto c = oc.length_squared() - r*r;
@@ -100,9 +102,9 @@ bool Sphere::hit(const ray& ray, const double t_min, const double t_max, hit_rec
 
   rec.t = root;
   rec.p = ray.at(rec.t);
-  vec3 outward_normal = (rec.p - this->center) / r;
+  vec3 outward_normal = (rec.p - center) / r;
   rec.set_face_normal(ray, outward_normal);
-  rec.mat_ptr = this->mat_ptr;
+  rec.mat_ptr = mat;
   return true;
 }
 
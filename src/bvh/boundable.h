@@ -15,7 +15,7 @@ class Extent
 public:
     Extent();
     void extendBy(const Extent* extents);
-    bool interset(const double *numberator, const double *denominator, double &tNear, double &tFar, int &planeIndex);
+    bool interset(const double *numberator, const double *denominator, double &tNear, double &tFar, int &planeIndex) const;
     vec3 centroid() const;
 
 public:
@@ -41,6 +41,10 @@ class Sphere: public Boundable{
     ~Sphere();
     void calculateBounds(const vec3 normalPlanes[], const int planeSize, const vec3 origin, Extent* &outputExtent) override;
     bool hit(const ray& ray, double t_min, double t_max, hit_record &rec) const;
+    /**
+     * @brief ray sphere intersection for spheres that are not held in a Sphere
+     */
+    static bool hit(const vec3 &center, double r, material *mat, const ray& ray, double t_min, double t_max, hit_record &rec);
     vec3 center;
     material* mat_ptr;
     double r;
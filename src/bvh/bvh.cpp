@@ -3,6 +3,8 @@
 #include <stdint.h>
 #include <algorithm> //for swap function
 #include "boundable.h"
+#include "flat_scene.h"
+#include <iostream>
 #include <queue>
 
 BBox::BBox(vec3 min, vec3 max)
@@ -199,7 +201,25 @@ BVH::BVH(std::vector<Sphere*>& objects){
     delete scene;
 }
 
+BVH::BVH(const char *flatScene, size_t size){
+    if(!isFlatScene(flatScene, size)){
+        std::cerr<<"Invalid flat scene"<<std::endl;
+        exit(1);
+    }
+    flat = reinterpret_cast<const FlatSceneHeader*>(flatScene);
+    flatSpheres = reinterpret_cast<const FlatSphere*>(flatScene + flat->spheresOffset);
+    flatNodes = reinterpret_cast<const FlatNode*>(flatScene + flat->nodesOffset);
+    flatLeafSpheres = reinterpret_cast<const uint32_t*>(flatScene + flat->leafSpheresOffset);
+    const material_record *materials = reinterpret_cast<const material_record*>(flatScene + flat->materialsOffset);
+    for(uint32_t i=0; i<flat->materialCount; i++){
+        flatMaterials.push_back(make_material(materials[i]));
+    }
+}
+
 BVH::~BVH(){
+    for(auto m: flatMaterials){
+        delete m;
+    }
     if(tree!=nullptr){
         delete tree;
         tree = nullptr;
@@ -213,6 +233,9 @@ BVH::~BVH(){
 }
 
 bool BVH::intersect(const ray &ray, Sphere **hit_object, hit_record& hit_record_out){
+    if(flat!=nullptr){
+        return intersectFlat(ray, hit_record_out);
+    }
     double tHit = DBL_MAX;
     Sphere *hitObject = nullptr;
     hit_record hitRecord;
@@ -272,3 +295,70 @@ bool BVH::intersect(const ray &ray, Sphere **hit_object, hit_record& hit_record_
     }
     return false;
 }
+
+namespace{
+struct FlatQueueElement
+{
+    uint32_t node;
+    double t;
+    FlatQueueElement(uint32_t n, double tn) : node(n), t(tn) {}
+    friend bool operator<(const FlatQueueElement &a, const FlatQueueElement &b) { return a.t > b.t; }
+};
+}
+
+// the same traversal as intersect, over node and sphere indices
+bool BVH::intersectFlat(const ray &ray, hit_record &hit_record_out) const{
+    double n_dot_o[kNumPlaneSetNormals];
+    double n_dot_r[kNumPlaneSetNormals];
+    for(int i=0; i<kNumPlaneSetNormals; i++){
+        n_dot_o[i] = dot(planeSetNormals[i], ray.origin());
+        n_dot_r[i] = dot(planeSetNormals[i], ray.direction());
+    }
+
+    double tNear = 0.001, tFar = DBL_MAX;
+    int plane_index=-1;
+    if(!flatNodes[0].extent.interset(n_dot_o, n_dot_r, tNear, tFar, plane_index) || tFar<0){
+        return false;
+    }
+
+    double tHit = tFar;
+    bool hit = false;
+    hit_record hitRecord;
+    std::priority_queue<FlatQueueElement> queue;
+    queue.push(FlatQueueElement(0,0));
+    while(!queue.empty() && queue.top().t<tHit){
+        const FlatNode &node = flatNodes[queue.top().node];
+        queue.pop();
+        if(node.isLeaf){
+            for(uint32_t k=node.first; k<node.first+node.count; k++){
+                const FlatSphere &s = flatSpheres[flatLeafSpheres[k]];
+                hit_record currentHitRecord;
+                if(Sphere::hit(vec3(s.center[0], s.center[1], s.center[2]), s.radius, flatMaterials[s.materialId],
+                               ray, tNear, tHit, currentHitRecord)
+                && currentHitRecord.t <tHit){
+                    hit = true;
+                    hitRecord = currentHitRecord;
+                    tHit = hitRecord.t;
+                }
+            }
+        }
+        else{
+            for(int i=0;i<8;i++){
+                if(node.child[i]>=0){
+                    double tNearChild = 0;
+                    double tFarChild = tFar;
+                    int planeIndex;
+                    if(flatNodes[node.child[i]].extent.interset(n_dot_o, n_dot_r, tNearChild, tFarChild, planeIndex)){
+                        double t = (tNearChild < 0 && tFarChild >=0)?tFarChild:tNearChild;
+                        queue.push(FlatQueueElement(node.child[i],t));
+                    }
+                }
+            }
+        }
+    }
+
+    if(hit){
+        hit_record_out = hitRecord;
+    }
+    return hit;
+}
@@ -65,17 +65,39 @@ private:
     void deleteOctreeNode(OctreeNode *&node);
 };
 
+struct FlatSceneHeader;
+struct FlatSphere;
+struct FlatNode;
+
 class BVH
 {
 public:
     BVH(std::vector<Sphere *> &scene);
+    /**
+     * @brief use a flat scene (see flat_scene.h) in place, without copying it. The buffer
+     * must outlive the BVH. Only the materials are allocated, once per distinct material.
+     * Exits if the buffer is not a valid flat scene.
+     */
+    BVH(const char *flatScene, size_t size);
     ~BVH();
+    /**
+     * @brief closest hit along the ray. A BVH over a flat scene has no Sphere objects
+     * and leaves *hit_object unchanged.
+     */
     bool intersect(const ray &ray, Sphere **hit_object, hit_record &hitRecord);
     Octree *tree = nullptr;
 
 private:
+    bool intersectFlat(const ray &ray, hit_record &hitRecord) const;
+
     static const vec3 planeSetNormals[kNumPlaneSetNormals];
     std::vector<Extent *> extentList;
+
+    const FlatSceneHeader *flat = nullptr;
+    const FlatSphere *flatSpheres = nullptr;
+    const FlatNode *flatNodes = nullptr;
+    const uint32_t *flatLeafSpheres = nullptr;
+    std::vector<material *> flatMaterials;
 };
 
 /**
@@ -3,6 +3,17 @@
 #include "bvh.hpp"
 #include "ray.h"
 #include "ray_tracing.h"
+#include "flat_scene.h"
+#include "material_record.h"
+#include "task_pool.h"
+#include "camera_path.h"
+#include "render_budget.h"
+#include "render_jobs.h"
+#include "render_schedule.h"
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
 
 TEST(SanityCheck, testcase1)
 {
@@ -332,3 +343,426 @@ TEST(ray_tracing, tile_indexes_calculation){
     }
 }
 
+
+TEST(progressive, checkpoint_round_trip){
+    render_checkpoint saved;
+    saved.seed = 42;
+    saved.passes_done = 3;
+    saved.samples_per_pass = 8;
+    saved.image = framebuffer(4, 2);
+    saved.image.add(5, color(1, 2, 3), 8);
+    ASSERT_TRUE(save_checkpoint("checkpoint_test.chk", saved));
+
+    render_checkpoint loaded;
+    ASSERT_TRUE(load_checkpoint("checkpoint_test.chk", loaded));
+    ASSERT_EQ(42, loaded.seed);
+    ASSERT_EQ(3, loaded.passes_done);
+    ASSERT_EQ(8, loaded.samples_per_pass);
+    ASSERT_EQ(4, loaded.image.width);
+    ASSERT_EQ(2, loaded.image.height);
+    vec3_eq(color(1, 2, 3), loaded.image.sum(5));
+    ASSERT_EQ(8, loaded.image.samples(5));
+    ASSERT_EQ(0, loaded.image.samples(0));
+    std::remove("checkpoint_test.chk");
+
+    ASSERT_FALSE(load_checkpoint("checkpoint_test.chk", loaded));
+}
+
+TEST(denoise, smooths_noise_but_keeps_normal_edges){
+    const int width = 16, height = 16, spp = 4;
+    std::vector<color> image(width * height);
+    aux_buffer aux(width, height);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            int p = y * width + x;
+            bool left = x < width / 2;
+            double noise = ((x + y) % 2 == 0) ? 0.05 : -0.05;
+            image[p] = color(spp * ((left ? 0.8 : 0.2) + noise));
+            aux.store(p, first_hit{color(1), left ? vec3(1, 0, 0) : vec3(0, 1, 0), 5.0}, 1);
+        }
+    }
+    denoiseConfig config;
+    denoise_atrous(image.data(), width, height, spp, aux, config);
+
+    for (int y = 0; y < height; y++)
+    {
+        ASSERT_NEAR(0.8, image[y * width + 2].x() / spp, 0.02);
+        ASSERT_NEAR(0.8, image[y * width + width / 2 - 1].x() / spp, 0.02);
+        ASSERT_NEAR(0.2, image[y * width + width / 2].x() / spp, 0.02);
+    }
+}
+
+TEST(image_io, binary_ppm_round_trip_and_qoi_header){
+    const int width = 5, height = 3, spp = 2;
+    std::vector<color> image(width * height);
+    for (int i = 0; i < width * height; i++)
+        image[i] = color(spp * 0.01 * i, spp * 0.25, spp * 0.9);
+
+    image_output output;
+    output.path = "image_io_test.ppm";
+    ASSERT_TRUE(write_image(output, image.data(), width, height, spp));
+
+    int read_width = 0, read_height = 0;
+    std::vector<unsigned char> rgb;
+    ASSERT_TRUE(read_ppm(output.path, read_width, read_height, rgb));
+    std::remove(output.path.c_str());
+    ASSERT_EQ(width, read_width);
+    ASSERT_EQ(height, read_height);
+    for (int i = 0; i < width * height; i++)
+    {
+        ASSERT_EQ(to_8bit(0.01 * i), rgb[3 * i]);
+        ASSERT_EQ(to_8bit(0.25), rgb[3 * i + 1]);
+    }
+
+    // one QOI_OP_RGB, then QOI_OP_RUN for the remaining identical pixels
+    std::vector<color> flat(width * height, color(0.5, 0.5, 0.5));
+    auto qoi = encode_image(image_format::qoi, flat.data(), width, height, 1);
+    ASSERT_EQ(14u + 4 + 1 + 8, qoi.size());
+    ASSERT_EQ('q', qoi[0]);
+    ASSERT_EQ(0xfe, qoi[14]);
+    ASSERT_EQ(0xc0 | (width * height - 2), qoi[18]);
+    ASSERT_EQ(1, qoi.back());
+}
+
+TEST(image_io, tile_writer_matches_whole_image){
+    const int width = 13, height = 9, spp = 3, tile = 4;
+    std::vector<color> image(width * height);
+    for (int i = 0; i < width * height; i++)
+        image[i] = color(spp * 0.007 * i, spp * 0.5 * (i % 3), spp * 0.1);
+
+    for (image_format format : {image_format::ppm_binary, image_format::pfm, image_format::qoi})
+    {
+        image_output output{format, "tile_writer_test.img"};
+        {
+            tile_writer writer(output, width, height, spp, tile);
+            // tiles of each band right to left, so rows are completed out of order
+            for (int y = 0; y < height; y += tile)
+                for (int x = (width - 1) / tile * tile; x >= 0; x -= tile)
+                    writer.submit_tile(x, y, std::min(tile, width - x), std::min(tile, height - y),
+                                       &image[y * width + x], width);
+            ASSERT_TRUE(writer.finish());
+        }
+        std::ifstream file(output.path, std::ios::binary);
+        std::vector<unsigned char> written((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        std::remove(output.path.c_str());
+        ASSERT_EQ(encode_image(format, image.data(), width, height, spp), written);
+    }
+}
+
+TEST(wire_format, encodings_keep_the_8bit_output){
+    const int spp = 37;
+    for (wire_format format : {wire_format::float32, wire_format::half, wire_format::rgbe})
+    {
+        std::vector<unsigned char> encoded(wire_pixel_size(format));
+        for (int i = 0; i < 20000; i++)
+        {
+            // spread over the whole output range, including very dark and clamped pixels
+            color mean(pow(random_double(), 4) * 1.2, random_double() * 0.01, random_double());
+            color sum = spp * mean;
+            encode_wire_pixel(format, sum, spp, encoded.data());
+            color decoded = decode_wire_pixel(format, encoded.data(), spp);
+            for (int c = 0; c < 3; c++)
+                ASSERT_EQ(to_8bit(sum[c] * (1.0 / spp)), to_8bit(decoded[c] * (1.0 / spp))) << wire_name(format) << " " << sum[c];
+        }
+    }
+}
+
+TEST(flat_scene, hits_match_the_pointer_octree){
+    std::vector<Sphere*> spheres;
+    for(int i = 0; i < 300; i++){
+        vec3 center(random_double(-8, 8), random_double(-8, 8), random_double(-8, 8));
+        material *m = (i % 3 == 0) ? static_cast<material*>(new dielectric(1.5))
+                                    : new metal(color(0.5, 0.6, 0.7), (i % 5) / 10.0);
+        spheres.push_back(new Sphere(center, random_double(0.1, 1), m));
+    }
+    BVH world(spheres);
+    std::vector<char> buffer;
+    flattenScene(spheres, world, buffer);
+    ASSERT_TRUE(isFlatScene(buffer.data(), buffer.size()));
+    ASSERT_FALSE(isFlatScene(buffer.data(), buffer.size() - 1));
+
+    // relocated to a different address before use
+    std::vector<char> moved(buffer);
+    BVH flatWorld(moved.data(), moved.size());
+    int hits = 0;
+    for(int i = 0; i < 2000; i++){
+        ray r(vec3(random_double(-12, 12), random_double(-12, 12), 20), random_in_unit_sphere() - vec3(0, 0, 1));
+        hit_record expected, actual;
+        Sphere *hitObject = nullptr;
+        bool hit = world.intersect(r, &hitObject, expected);
+        ASSERT_EQ(hit, flatWorld.intersect(r, &hitObject, actual));
+        if(hit){
+            hits++;
+            ASSERT_EQ(expected.t, actual.t);
+            vec3_eq(expected.normal, actual.normal);
+            material_record a = describe_material(expected.mat_ptr), b = describe_material(actual.mat_ptr);
+            ASSERT_EQ(0, memcmp(&a, &b, sizeof(a)));
+        }
+    }
+    ASSERT_GT(hits, 100);
+    for(auto s : spheres)
+        delete s;
+}
+
+TEST(task_pool, runs_nested_tasks_before_wait_idle_returns){
+    std::atomic_int leaves(0);
+    std::atomic_int parents(0);
+    task_pool pool(4);
+    ASSERT_EQ(pool.size(), 4);
+    for (int round = 0; round < 3; round++)
+    {
+        for (int i = 0; i < 100; i++)
+        {
+            pool.submit([&] {
+                parents++;
+                for (int j = 0; j < 10; j++)
+                    pool.submit([&] { leaves++; });
+            });
+        }
+        pool.wait_idle();
+        ASSERT_EQ(parents, 100 * (round + 1));
+        ASSERT_EQ(leaves, 1000 * (round + 1));
+        ASSERT_EQ(pool.queued(), 0u);
+    }
+}
+
+TEST(ray_tracing, balanced_partition_splits_by_cost){
+    // expensive rows in the middle, as around the large spheres
+    std::vector<double> cost = {1, 1, 1, 1, 8, 8, 8, 8, 1, 1, 1, 1};
+    std::vector<int> bounds = balancedPartition(cost, 4);
+    ASSERT_EQ(bounds, (std::vector<int>{0, 5, 6, 7, 12}));
+
+    std::vector<int> even = balancedPartition(std::vector<double>(10, 1.0), 2);
+    ASSERT_EQ(even, (std::vector<int>{0, 5, 10}));
+
+    // more parts than rows leaves some empty, the bounds never go backwards
+    std::vector<int> few = balancedPartition(std::vector<double>(2, 1.0), 4);
+    ASSERT_EQ(few.front(), 0);
+    ASSERT_EQ(few.back(), 2);
+    for (size_t p = 1; p < few.size(); p++)
+        ASSERT_LE(few[p - 1], few[p]);
+}
+
+TEST(camera_path, passes_through_keyframes_and_numbers_frames){
+    const char *path = "camera_path_test.txt";
+    {
+        std::ofstream file(path);
+        file << "# time lookfrom lookat vfov\n"
+             << "0 0 0 10 0 0 0\n"
+             << "\n"
+             << "1 10 0 10 0 0 0 30\n"
+             << "2 20 0 10 0 0 0\n";
+    }
+    std::vector<camera_key> keys;
+    ASSERT_TRUE(load_camera_path(path, keys));
+    std::remove(path);
+    ASSERT_EQ(keys.size(), 3u);
+    ASSERT_DOUBLE_EQ(keys[0].vfov, 20);
+    ASSERT_DOUBLE_EQ(keys[1].vfov, 30);
+
+    // keyframes are hit exactly, evenly spaced keys are followed linearly
+    camera at_key = camera_at(keys, 1.0, 1.5, 0, 10);
+    vec3_eq(at_key.origin, vec3(10, 0, 10));
+    camera between = camera_at(keys, 0.5, 1.5, 0, 10);
+    vec3_eq(between.origin, vec3(5, 0, 10));
+    camera after = camera_at(keys, 5.0, 1.5, 0, 10);
+    vec3_eq(after.origin, vec3(20, 0, 10));
+    ASSERT_DOUBLE_EQ(frame_time(keys, 4, 5), 2.0);
+
+    image_output output;
+    output.path = "shots/fly.v2.ppm";
+    ASSERT_EQ(frame_output(output, 7).path, "shots/fly.v2_0007.ppm");
+    output.path = "shots.d/fly";
+    ASSERT_EQ(frame_output(output, 12).path, "shots.d/fly_0012");
+    output.path = "";
+    output.format = image_format::qoi;
+    ASSERT_EQ(frame_output(output, 3).path, "frame_0003.qoi");
+}
+
+TEST(ray_tracing, region_rows_match_the_full_frame){
+    std::vector<Sphere*> spheres;
+    for(int i = 0; i < 20; i++){
+        vec3 center(random_double(-3, 3), random_double(-1, 1), random_double(-3, 3));
+        spheres.push_back(new Sphere(center, 0.5, new lambertian(color(0.4, 0.6, 0.8))));
+    }
+    BVH world(spheres);
+    camera cam = camera::getDefault();
+    const int width = 24, height = 16;
+    traceConfig config(cam, width, height, 10, 4, 2, 0, 1);
+    config.seed = 7;
+    std::vector<color> full(width * height), rows(width * 5);
+    raytracing_bvh_region(config, world, 0, 0, width, height, full.data());
+
+    // rows 6..10 on a different thread count
+    config.numProcs = 1;
+    raytracing_bvh_region(config, world, 0, 6, width, 5, rows.data());
+    for(int k = 0; k < width * 5; k++)
+        vec3_eq(rows[k], full[6 * width + k]);
+    for(auto s : spheres)
+        delete s;
+}
+
+TEST(render_budget, sizes_work_by_the_measured_cost){
+    render_budget budget(100);
+    // nothing measured yet, whatever is asked for may start
+    ASSERT_TRUE(budget.fits(1e12));
+    ASSERT_EQ(budget.samples_that_fit(100, 50), 50);
+
+    // a millisecond per sample, 100 seconds hold a bit over 800 samples of 100 pixels with the margin
+    budget.record(1.0, 1000);
+    ASSERT_TRUE(budget.fits(1000));
+    ASSERT_FALSE(budget.fits(100000));
+    int samples = budget.samples_that_fit(100, 100000);
+    ASSERT_GE(samples, 800);
+    ASSERT_LE(samples, 834);
+    ASSERT_EQ(budget.samples_that_fit(100, 10), 10);
+
+    render_budget spent(0);
+    ASSERT_EQ(spent.samples_that_fit(1, 10), 0);
+
+    framebuffer image(2, 1);
+    image.add(0, color(1, 1, 1), 4);
+    image.add(1, color(1, 1, 1), 8);
+    ASSERT_EQ(samples_summary(image), "4 6 8");
+}
+
+// the sizes chunk_size hands out until the frame is exhausted
+static std::vector<int> chunk_sequence(const render_schedule &schedule, int total, int procs, int minimum,
+                                       double speed = 1.0){
+    std::vector<int> sizes;
+    for(int remaining = total; remaining > 0 && sizes.size() <= static_cast<size_t>(total); remaining -= sizes.back())
+        sizes.push_back(chunk_size(schedule, total, remaining, procs, minimum, speed));
+    return sizes;
+}
+
+TEST(render_schedule, every_chunk_policy_hands_out_the_whole_frame){
+    for(int policy = 0; policy < num_chunk_policies; policy++)
+        for(int total : {1, 97, 240, 1080})
+            for(int procs : {1, 3, 8})
+                for(int minimum : {1, 5})
+                    for(double speed : {0.1, 1.0, 3.0}){
+                        render_schedule schedule;
+                        schedule.chunks = static_cast<chunk_policy>(policy);
+                        schedule.chunk_rows = 7;
+                        std::vector<int> sizes = chunk_sequence(schedule, total, procs, minimum, speed);
+                        int sum = 0;
+                        for(int size : sizes){
+                            ASSERT_GE(size, std::min(minimum, total)) << chunk_policy_name(schedule.chunks);
+                            sum += size;
+                        }
+                        ASSERT_EQ(sum, total) << chunk_policy_name(schedule.chunks);
+                    }
+}
+
+TEST(render_schedule, trapezoid_chunks_shrink_linearly_to_the_minimum){
+    render_schedule schedule;
+    schedule.chunks = chunk_policy::trapezoid;
+    // 420 rows on 2 ranks: from 420 / 4 down by 14 rows a chunk to the minimum
+    ASSERT_EQ(chunk_sequence(schedule, 420, 2, 35), (std::vector<int>{105, 91, 77, 63, 49, 35}));
+    for(int total : {97, 240, 1000, 4321})
+        for(int procs : {2, 4, 8}){
+            std::vector<int> sizes = chunk_sequence(schedule, total, procs, 2);
+            ASSERT_EQ(sizes[0], total / (2 * procs));
+            // the last chunk takes the rows that would leave less than the minimum
+            for(size_t i = 1; i + 1 < sizes.size(); i++)
+                ASSERT_LE(sizes[i], sizes[i - 1]);
+            ASSERT_LT(sizes.back(), sizes[sizes.size() - 2] + 2);
+        }
+}
+
+TEST(render_schedule, adaptive_chunks_scale_with_the_clamped_speed){
+    render_schedule guided, adaptive;
+    adaptive.chunks = chunk_policy::adaptive;
+    const int total = 1000, remaining = 900, procs = 4, minimum = 3;
+    const int base = chunk_size(guided, total, remaining, procs, minimum, 1.0);
+    ASSERT_EQ(base, 75);
+    ASSERT_EQ(chunk_size(adaptive, total, remaining, procs, minimum, 1.0), base);
+    ASSERT_EQ(chunk_size(adaptive, total, remaining, procs, minimum, 2.0), 2 * base);
+    ASSERT_EQ(chunk_size(adaptive, total, remaining, procs, minimum, 0.5), base / 2);
+    // speeds outside [0.25, 4] count as the bound
+    ASSERT_EQ(chunk_size(adaptive, total, remaining, procs, minimum, 4.0), 4 * base);
+    ASSERT_EQ(chunk_size(adaptive, total, remaining, procs, minimum, 50.0), 4 * base);
+    ASSERT_EQ(chunk_size(adaptive, total, remaining, procs, minimum, 0.25), base / 4);
+    ASSERT_EQ(chunk_size(adaptive, total, remaining, procs, minimum, 0.01), base / 4);
+}
+
+TEST(common, random_counter_replays_and_leaves_the_generator_alone){
+    reseed_generator(5);
+    double expected = random_double();
+    reseed_generator(5);
+
+    uint64_t start = 42, state = start;
+    use_random_counter(&state);
+    double a = random_double(), b = random_double();
+    use_random_counter(nullptr);
+    ASSERT_NE(state, start);
+    ASSERT_NE(a, b);
+    ASSERT_GE(a, 0.0);
+    ASSERT_LT(a, 1.0);
+    // the same counter gives the same draws, and the generator did not move meanwhile
+    state = start;
+    use_random_counter(&state);
+    ASSERT_EQ(random_double(), a);
+    use_random_counter(nullptr);
+    ASSERT_EQ(random_double(), expected);
+}
+
+TEST(ray_tracing, crop_options_read_rectangles_and_tiles){
+    const char *argv[] = {"bvh_mt", "--crop=1,2,3,4+10,0,5,5", "--crop-tiles=16:1,4"};
+    options opts(3, const_cast<char **>(argv));
+    std::vector<cropRect> rects;
+    ASSERT_TRUE(crop_options(opts, 40, 30, rects));
+    ASSERT_EQ(rects.size(), 4u);
+    ASSERT_EQ(rects[0].x0, 1);
+    ASSERT_EQ(rects[0].h, 4);
+    ASSERT_EQ(rects[1].x0, 10);
+    // tile 1 is the second of the top row, tile 4 the second of the second row, cut by the bottom edge
+    ASSERT_EQ(rects[2].x0, 16);
+    ASSERT_EQ(rects[2].y0, 0);
+    ASSERT_EQ(rects[3].x0, 16);
+    ASSERT_EQ(rects[3].y0, 16);
+    ASSERT_EQ(rects[3].h, 14);
+
+    const char *none[] = {"bvh_mt", "--spp=4"};
+    ASSERT_FALSE(crop_options(options(2, const_cast<char **>(none)), 40, 30, rects));
+}
+
+TEST(render_service, a_malformed_scene_fails_its_job_and_the_next_one_is_served){
+    std::ofstream("render_service_text.data") << "this is not a scene\n";
+    std::ofstream("render_service_material.data")
+        << R"({"spheres":[{"sphere":{"location":{"x":0,"y":0,"z":0},"radius":1,"material":{"type":"plasma"}}}]})";
+    FILE *in = std::tmpfile();
+    FILE *out = std::tmpfile();
+    std::fputs("--scene=render_service_text.data --width=8 --height=6 --spp=1\n"
+               "--scene=render_service_material.data --width=8 --height=6 --spp=1\n"
+               "--scene=gen:uniform,count=50,seed=2 --width=8 --height=6 --spp=1 --format=p6\n", in);
+    std::rewind(in);
+    scene_cache cache(2);
+    job_stream stream(fileno(in), fileno(out));
+    ASSERT_TRUE(serve(stream, cache, 1));
+    std::remove("render_service_text.data");
+    std::remove("render_service_material.data");
+
+    std::rewind(out);
+    std::string replies;
+    char chunk[4096];
+    size_t n;
+    while((n = std::fread(chunk, 1, sizeof(chunk), out)) > 0)
+        replies.append(chunk, n);
+    std::fclose(in);
+    std::fclose(out);
+    size_t first = replies.find('\n'), second = replies.find('\n', first + 1);
+    ASSERT_NE(second, std::string::npos);
+    ASSERT_EQ(replies.compare(0, 6, "ERROR "), 0);
+    ASSERT_EQ(replies.compare(first + 1, 6, "ERROR "), 0);
+    // the valid job after them is rendered, its image follows the reply line
+    size_t third = replies.find('\n', second + 1);
+    ASSERT_NE(third, std::string::npos);
+    ASSERT_EQ(replies.compare(second + 1, 3, "OK "), 0);
+    size_t bytes = std::stoul(replies.substr(second + 4));
+    ASSERT_EQ(replies.size() - third - 1, bytes);
+    ASSERT_EQ(replies.compare(third + 1, 2, "P6"), 0);
+    ASSERT_EQ(cache.size(), 1u);
+}
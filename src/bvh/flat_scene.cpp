@@ -0,0 +1,146 @@
+#include "flat_scene.h"
+#include "bvh.hpp"
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+static const char kFlatSceneMagic[8] = {'P', 'R', 'F', 'L', 'A', 'T', '\0', '\0'};
+static const uint32_t kFlatSceneVersion = 1;
+static const uint64_t kArrayAlignment = 64;
+
+static uint64_t alignUp(uint64_t offset)
+{
+    return (offset + kArrayAlignment - 1) / kArrayAlignment * kArrayAlignment;
+}
+
+template <typename T>
+static void copyArray(std::vector<char> &buffer, uint64_t offset, const std::vector<T> &values)
+{
+    if (!values.empty())
+        std::memcpy(buffer.data() + offset, values.data(), values.size() * sizeof(T));
+}
+
+void flattenScene(const std::vector<Sphere *> &spheres, const BVH &world, std::vector<char> &buffer)
+{
+    std::unordered_map<const Sphere *, uint32_t> sphereIndex;
+    std::vector<FlatSphere> flatSpheres(spheres.size());
+    std::vector<material_record> materials;
+    // identical materials share one entry
+    std::unordered_map<std::string, uint32_t> known;
+    for (size_t i = 0; i < spheres.size(); i++)
+    {
+        const Sphere *s = spheres[i];
+        sphereIndex[s] = i;
+        material_record m = describe_material(s->mat_ptr);
+        std::string key(reinterpret_cast<const char *>(&m), sizeof(m));
+        auto found = known.find(key);
+        if (found == known.end())
+        {
+            found = known.emplace(key, static_cast<uint32_t>(materials.size())).first;
+            materials.push_back(m);
+        }
+        FlatSphere &f = flatSpheres[i];
+        for (int c = 0; c < 3; c++)
+            f.center[c] = s->center[c];
+        f.radius = s->r;
+        f.materialId = found->second;
+        f.reserved = 0;
+    }
+
+    // nodes in breadth first order, so every child index is known when its parent is written
+    std::vector<const OctreeNode *> order(1, world.tree->root);
+    std::vector<FlatNode> nodes;
+    std::vector<uint32_t> leafSpheres;
+    for (size_t n = 0; n < order.size(); n++)
+    {
+        const OctreeNode *node = order[n];
+        FlatNode f;
+        f.extent = *node->currentNodeExtent;
+        f.extent.object = nullptr;
+        f.isLeaf = node->isLeaf;
+        f.first = leafSpheres.size();
+        f.reserved = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            f.child[i] = -1;
+            if (node->child[i] != nullptr)
+            {
+                f.child[i] = order.size();
+                order.push_back(node->child[i]);
+            }
+        }
+        if (node->isLeaf)
+        {
+            for (const Extent *e : node->nodeExtentsList)
+                leafSpheres.push_back(sphereIndex.at(e->object));
+        }
+        f.count = leafSpheres.size() - f.first;
+        nodes.push_back(f);
+    }
+
+    FlatSceneHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kFlatSceneMagic, sizeof(kFlatSceneMagic));
+    header.version = kFlatSceneVersion;
+    header.materialCount = materials.size();
+    header.sphereCount = flatSpheres.size();
+    header.nodeCount = nodes.size();
+    header.leafSphereCount = leafSpheres.size();
+    header.spheresOffset = alignUp(sizeof(header));
+    header.materialsOffset = alignUp(header.spheresOffset + flatSpheres.size() * sizeof(FlatSphere));
+    header.nodesOffset = alignUp(header.materialsOffset + materials.size() * sizeof(material_record));
+    header.leafSpheresOffset = alignUp(header.nodesOffset + nodes.size() * sizeof(FlatNode));
+    header.size = header.leafSpheresOffset + leafSpheres.size() * sizeof(uint32_t);
+
+    buffer.assign(header.size, 0);
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    copyArray(buffer, header.spheresOffset, flatSpheres);
+    copyArray(buffer, header.materialsOffset, materials);
+    copyArray(buffer, header.nodesOffset, nodes);
+    copyArray(buffer, header.leafSpheresOffset, leafSpheres);
+}
+
+// true if count elements of elementSize at offset lie inside size bytes and are aligned
+static bool arrayFits(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t size)
+{
+    if (offset % kArrayAlignment != 0 || offset > size)
+        return false;
+    return count <= (size - offset) / elementSize;
+}
+
+bool isFlatScene(const char *buffer, size_t size)
+{
+    if (buffer == nullptr || size < sizeof(FlatSceneHeader))
+        return false;
+    FlatSceneHeader header;
+    std::memcpy(&header, buffer, sizeof(header));
+    if (std::memcmp(header.magic, kFlatSceneMagic, sizeof(kFlatSceneMagic)) != 0 ||
+        header.version != kFlatSceneVersion || header.size > size || header.nodeCount == 0)
+        return false;
+    if (!arrayFits(header.spheresOffset, header.sphereCount, sizeof(FlatSphere), header.size) ||
+        !arrayFits(header.materialsOffset, header.materialCount, sizeof(material_record), header.size) ||
+        !arrayFits(header.nodesOffset, header.nodeCount, sizeof(FlatNode), header.size) ||
+        !arrayFits(header.leafSpheresOffset, header.leafSphereCount, sizeof(uint32_t), header.size))
+        return false;
+
+    // every index has to stay inside its array
+    const FlatSphere *spheres = reinterpret_cast<const FlatSphere *>(buffer + header.spheresOffset);
+    for (uint64_t i = 0; i < header.sphereCount; i++)
+        if (spheres[i].materialId >= header.materialCount)
+            return false;
+    const FlatNode *nodes = reinterpret_cast<const FlatNode *>(buffer + header.nodesOffset);
+    for (uint64_t n = 0; n < header.nodeCount; n++)
+    {
+        if (static_cast<uint64_t>(nodes[n].first) + nodes[n].count > header.leafSphereCount)
+            return false;
+        for (int i = 0; i < 8; i++)
+            if (nodes[n].child[i] >= static_cast<int64_t>(header.nodeCount) ||
+                (nodes[n].child[i] >= 0 && static_cast<uint64_t>(nodes[n].child[i]) <= n))
+                return false;
+    }
+    const uint32_t *leafSpheres = reinterpret_cast<const uint32_t *>(buffer + header.leafSpheresOffset);
+    for (uint64_t i = 0; i < header.leafSphereCount; i++)
+        if (leafSpheres[i] >= header.sphereCount)
+            return false;
+    return true;
+}
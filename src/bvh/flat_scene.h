@@ -0,0 +1,65 @@
+#ifndef __H_FLAT_SCENE__
+#define __H_FLAT_SCENE__
+
+#include <cstdint>
+#include <vector>
+#include "boundable.h"
+#include "material_record.h"
+
+class BVH;
+
+/**
+ * A scene and its octree in one relocatable buffer. Every reference is an index
+ * into one of the arrays, so the bytes can be broadcast or placed in shared
+ * memory and used in place by BVH(const char *, size_t).
+ *
+ *   FlatSceneHeader
+ *   FlatSphere      spheres[sphereCount]      every array starts at a 64-byte aligned offset
+ *   material_record materials[materialCount]
+ *   FlatNode        nodes[nodeCount]          nodes[0] is the root
+ *   uint32_t        leafSpheres[leafSphereCount]
+ */
+struct FlatSceneHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t materialCount;
+    uint64_t sphereCount;
+    uint64_t nodeCount;
+    uint64_t leafSphereCount;
+    uint64_t spheresOffset;
+    uint64_t materialsOffset;
+    uint64_t nodesOffset;
+    uint64_t leafSpheresOffset;
+    uint64_t size; // of the whole buffer
+};
+
+struct FlatSphere
+{
+    double center[3];
+    double radius;
+    uint32_t materialId;
+    uint32_t reserved;
+};
+
+struct FlatNode
+{
+    Extent extent;     // bounds of the node, extent.object is unused
+    int32_t child[8];  // node index, -1 if there is no child
+    uint32_t first;    // leaves: the node's spheres are leafSpheres[first, first + count)
+    uint32_t count;
+    uint32_t isLeaf;
+    uint32_t reserved;
+};
+
+/**
+ * @brief serialize spheres and the octree world built over them into buffer
+ */
+void flattenScene(const std::vector<Sphere *> &spheres, const BVH &world, std::vector<char> &buffer);
+
+/**
+ * @brief true if the size bytes at buffer hold a complete flat scene
+ */
+bool isFlatScene(const char *buffer, size_t size);
+
+#endif
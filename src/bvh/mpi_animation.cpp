@@ -0,0 +1,77 @@
+#include "mpi_animation.h"
+#include "bvh.hpp"
+#include "frame_writer.h"
+#include "task_pool.h"
+#include <omp.h>
+#include <iostream>
+
+bool animation_options(const options &opts, animation &anim)
+{
+  if(!opts.has("animate"))
+    return false;
+  const std::string path = opts.get("animate", "");
+  if(!load_camera_path(path, anim.path))
+    exit(1);
+  anim.frames = opts.get_int("frames", static_cast<int>(anim.path.size()));
+  if(anim.frames < 1)
+    {
+      std::cerr << "--frames must be at least 1" << std::endl;
+      exit(1);
+    }
+  return true;
+}
+
+animation_times render_animation(const traceConfig &config, BVH &world, int num_threads, const animation &anim)
+{
+  MPI_Barrier(MPI_COMM_WORLD);
+  double tstart = omp_get_wtime();
+
+  // the next unclaimed frame, on rank 0
+  int64_t *next_frame = nullptr;
+  MPI_Win counter;
+  MPI_Win_allocate(config.myRank == 0 ? sizeof(int64_t) : 0, sizeof(int64_t), MPI_INFO_NULL, MPI_COMM_WORLD,
+                   &next_frame, &counter);
+  if(config.myRank == 0)
+    *next_frame = 0;
+  MPI_Barrier(MPI_COMM_WORLD);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, counter);
+
+  animation_times times{0, 0, 0};
+  {
+    task_pool pool(num_threads);
+    // one frame renders while the previous one is written
+    frame_writer writer(1);
+    const int64_t one = 1;
+    const double aspect_ratio = static_cast<double>(config.width) / config.height;
+    while(true)
+      {
+        int64_t frame = 0;
+        MPI_Fetch_and_op(&one, &frame, MPI_INT64_T, 0, 0, MPI_SUM, counter);
+        MPI_Win_flush(0, counter);
+        if(frame >= anim.frames)
+          break;
+
+        double start = omp_get_wtime();
+        camera cam = camera_at(anim.path, frame_time(anim.path, static_cast<int>(frame), anim.frames), aspect_ratio,
+                               anim.aperture, anim.focus_dist);
+        traceConfig frame_config(cam, config.width, config.height, config.traceDepth, config.samplePerPixel,
+                                 config.numProcs, config.myRank, config.threadsPerProc);
+        frame_config.seed = mix_seed(config.seed, frame);
+        std::vector<color> sums(static_cast<size_t>(config.width) * config.height);
+        render_local(frame_config, world, pool, sums.data());
+        times.render += omp_get_wtime() - start;
+        times.frames++;
+
+        writer.submit(frame_output(config.output, static_cast<int>(frame)), std::move(sums), config.width,
+                      config.height, config.samplePerPixel);
+      }
+    if(!writer.finish())
+      std::cerr << "Rank " << config.myRank << " failed to write some frames" << std::endl;
+  }
+
+  MPI_Win_unlock_all(counter);
+  MPI_Barrier(MPI_COMM_WORLD);
+  MPI_Win_free(&counter);
+  times.all = omp_get_wtime() - tstart;
+  return times;
+}
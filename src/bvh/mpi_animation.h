@@ -0,0 +1,41 @@
+#ifndef __H_MPI_ANIMATION__
+#define __H_MPI_ANIMATION__
+
+#include <mpi.h>
+#include <vector>
+#include "camera_path.h"
+#include "options.h"
+#include "mpi_render.h"
+
+struct animation
+{
+    std::vector<camera_key> path;
+    int frames = 0;
+    double aperture = 0.1;
+    double focus_dist = 10.0;
+};
+
+/**
+ * @brief read --animate=camera_path and --frames=N, one frame per keyframe by
+ * default. Returns true if an animation was requested, exits if the camera path
+ * cannot be read.
+ */
+bool animation_options(const options &opts, animation &anim);
+
+struct animation_times
+{
+    double all;
+    double render; // of `all`, the time this rank rendered
+    int frames;    // frames rendered by this rank
+};
+
+/**
+ * @brief render the frames of a camera fly-through over the scene and BVH built
+ * once. Whole frames are handed out one at a time from a counter in rank 0's RMA
+ * window, so ranks of different speed take as many as they manage; each rank
+ * renders its frame with all of its threads and hands it to an I/O thread that
+ * writes it as a numbered file (see frame_output) while the next one renders.
+ */
+animation_times render_animation(const traceConfig &config, BVH &world, int num_threads, const animation &anim);
+
+#endif
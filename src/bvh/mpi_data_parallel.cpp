@@ -0,0 +1,594 @@
+#include "mpi_data_parallel.h"
+#include "bvh.hpp"
+#include "boundable.h"
+#include "material_record.h"
+#include <omp.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <list>
+#include <thread>
+
+// spreads the low 21 bits of v to every third bit
+static uint64_t spread_bits(uint64_t v)
+{
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffffull;
+  v = (v | v << 16) & 0x1f0000ff0000ffull;
+  v = (v | v << 8) & 0x100f00f00f00f00full;
+  v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+  v = (v | v << 2) & 0x1249249249249249ull;
+  return v;
+}
+
+// Morton code of p on a 2^21 grid over [lo, hi]
+static uint64_t morton_code(const vec3 &p, const vec3 &lo, const vec3 &hi)
+{
+  uint64_t code = 0;
+  for(int a = 0; a < 3; a++)
+    {
+      double extent = hi[a] - lo[a];
+      double f = extent > 0 ? (p[a] - lo[a]) / extent : 0;
+      uint64_t cell = static_cast<uint64_t>(std::min(std::max(f, 0.0), 1.0) * 0x1fffff);
+      code |= spread_bits(cell) << a;
+    }
+  return code;
+}
+
+namespace
+{
+// a sphere on its way to the rank that owns its part of the Morton order
+struct sphere_record
+{
+  uint64_t code;  // Morton code of the centre
+  uint64_t index; // position in the scene, breaks ties between codes
+  double center[3];
+  double radius;
+  material_record material;
+};
+
+bool key_less(const sphere_record &a, const sphere_record &b)
+{
+  return a.code < b.code || (a.code == b.code && a.index < b.index);
+}
+
+// samples of the sorted keys each rank contributes to choose the splitters
+const int samples_per_rank = 16;
+}
+
+scene_partition::scene_partition(std::vector<Sphere *> &block, uint64_t total_spheres, MPI_Comm comm)
+  : total(total_spheres)
+{
+  int rank = 0;
+  int procs = 1;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &procs);
+  const uint64_t first = total * rank / procs;
+
+  // the Morton grid spans the centres of the whole scene
+  double lo[3] = {DBL_MAX, DBL_MAX, DBL_MAX};
+  double hi[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+  for(const Sphere *s : block)
+    for(int a = 0; a < 3; a++)
+      {
+        lo[a] = std::min(lo[a], s->center[a]);
+        hi[a] = std::max(hi[a], s->center[a]);
+      }
+  MPI_Allreduce(MPI_IN_PLACE, lo, 3, MPI_DOUBLE, MPI_MIN, comm);
+  MPI_Allreduce(MPI_IN_PLACE, hi, 3, MPI_DOUBLE, MPI_MAX, comm);
+  const vec3 grid_lo(lo[0], lo[1], lo[2]);
+  const vec3 grid_hi(hi[0], hi[1], hi[2]);
+
+  std::vector<sphere_record> records(block.size());
+  for(size_t k = 0; k < block.size(); k++)
+    {
+      const Sphere *s = block[k];
+      sphere_record &r = records[k];
+      r.code = morton_code(s->center, grid_lo, grid_hi);
+      r.index = first + k;
+      for(int a = 0; a < 3; a++)
+        r.center[a] = s->center[a];
+      r.radius = s->r;
+      r.material = describe_material(s->mat_ptr);
+      delete s;
+    }
+  block.clear();
+  block.shrink_to_fit();
+  std::sort(records.begin(), records.end(), key_less);
+
+  // regular sampling: evenly spaced keys of every rank's sorted block, and the
+  // splitters evenly spaced among all samples, give every rank a run of at most
+  // about twice its even share
+  std::vector<uint64_t> samples;
+  for(int k = 0; k < samples_per_rank && !records.empty(); k++)
+    {
+      const sphere_record &r = records[records.size() * k / samples_per_rank];
+      samples.push_back(r.code);
+      samples.push_back(r.index);
+    }
+  int sample_count = static_cast<int>(samples.size());
+  std::vector<int> sample_counts(procs);
+  MPI_Allgather(&sample_count, 1, MPI_INT, sample_counts.data(), 1, MPI_INT, comm);
+  std::vector<int> sample_offsets(procs, 0);
+  for(int r = 1; r < procs; r++)
+    sample_offsets[r] = sample_offsets[r - 1] + sample_counts[r - 1];
+  std::vector<uint64_t> all_samples(sample_offsets[procs - 1] + sample_counts[procs - 1]);
+  MPI_Allgatherv(samples.data(), sample_count, MPI_UINT64_T, all_samples.data(), sample_counts.data(),
+                 sample_offsets.data(), MPI_UINT64_T, comm);
+  std::vector<sphere_record> keys(all_samples.size() / 2);
+  for(size_t k = 0; k < keys.size(); k++)
+    {
+      keys[k].code = all_samples[2 * k];
+      keys[k].index = all_samples[2 * k + 1];
+    }
+  std::sort(keys.begin(), keys.end(), key_less);
+
+  // the block is sorted, so the records of every owner are contiguous
+  std::vector<int> send_counts(procs, 0);
+  size_t next = 0;
+  for(int r = 0; r < procs; r++)
+    {
+      size_t end = records.size();
+      if(r + 1 < procs && !keys.empty())
+        {
+          const sphere_record &splitter = keys[keys.size() * (r + 1) / procs];
+          end = std::lower_bound(records.begin() + next, records.end(), splitter, key_less) - records.begin();
+        }
+      send_counts[r] = static_cast<int>(end - next);
+      next = end;
+    }
+  std::vector<int> receive_counts(procs);
+  MPI_Alltoall(send_counts.data(), 1, MPI_INT, receive_counts.data(), 1, MPI_INT, comm);
+  std::vector<int> send_offsets(procs, 0);
+  std::vector<int> receive_offsets(procs, 0);
+  for(int r = 1; r < procs; r++)
+    {
+      send_offsets[r] = send_offsets[r - 1] + send_counts[r - 1];
+      receive_offsets[r] = receive_offsets[r - 1] + receive_counts[r - 1];
+    }
+  std::vector<sphere_record> received(receive_offsets[procs - 1] + receive_counts[procs - 1]);
+  MPI_Datatype record_type;
+  MPI_Type_contiguous(sizeof(sphere_record), MPI_BYTE, &record_type);
+  MPI_Type_commit(&record_type);
+  MPI_Alltoallv(records.data(), send_counts.data(), send_offsets.data(), record_type, received.data(),
+                receive_counts.data(), receive_offsets.data(), record_type, comm);
+  MPI_Type_free(&record_type);
+  std::vector<sphere_record>().swap(records);
+
+  // every source sent a sorted run; in key order the share is the same on any number of ranks
+  std::sort(received.begin(), received.end(), key_less);
+  owned.reserve(received.size());
+  for(const sphere_record &r : received)
+    owned.push_back(new Sphere(point3(r.center[0], r.center[1], r.center[2]), r.radius, make_material(r.material)));
+  std::vector<sphere_record>().swap(received);
+
+  region_bounds mine;
+  for(int a = 0; a < 3; a++)
+    {
+      mine.lo[a] = DBL_MAX;
+      mine.hi[a] = -DBL_MAX;
+    }
+  for(const Sphere *s : owned)
+    for(int a = 0; a < 3; a++)
+      {
+        // a little slack keeps grazing hits inside the region
+        const double pad = s->r * 1e-6 + 1e-9;
+        mine.lo[a] = std::min(mine.lo[a], s->center[a] - s->r - pad);
+        mine.hi[a] = std::max(mine.hi[a], s->center[a] + s->r + pad);
+      }
+  bounds.resize(procs);
+  MPI_Allgather(&mine, 6, MPI_DOUBLE, bounds.data(), 6, MPI_DOUBLE, comm);
+
+  if(!owned.empty())
+    local_world.reset(new BVH(owned));
+}
+
+scene_partition::~scene_partition()
+{
+  local_world.reset();
+  for(Sphere *s : owned)
+    delete s;
+}
+
+namespace
+{
+// A ray in flight between the ranks. It is traced through the regions in order
+// of (entered, last_rank), then shaded by best_rank.
+struct ray_message
+{
+  double origin[3];
+  double direction[3];
+  double weight[3];   // product of the attenuations along the path so far
+  double best_t;      // closest hit found so far
+  double entered;     // entry distance of the region visited last
+  uint64_t random;    // splitmix64 counter of the path, see use_random_counter
+  int32_t pixel;      // index into the frame, row 0 at the top
+  int32_t depth;      // bounces left, as in ray_color
+  int32_t best_rank;  // owner of the closest hit, -1 if none
+  int32_t last_rank;  // region visited last, -1 before the first
+  int32_t shade;      // set once the ray goes to best_rank to be scattered
+  int32_t unused;
+};
+
+const int ray_tag = 46;
+// rays traced per round, between two looks at the network
+const size_t round_rays = 4096;
+// camera rays are only generated while fewer rays than this wait for a send to complete
+const size_t max_in_flight = 4 * round_rays;
+// batches are only received while fewer rays than this wait to be traced; the
+// rest stay with their senders, which then hold back their camera rays
+const size_t max_queued = 4 * round_rays;
+
+class data_parallel_renderer
+{
+public:
+  data_parallel_renderer(const traceConfig &config, scene_partition &scene)
+    : config(config), scene(scene), regions(scene.regions()), procs(config.numProcs),
+      rank(config.myRank), sums(static_cast<size_t>(config.width) * config.height, color(0, 0, 0)),
+      outgoing(config.numProcs)
+  {
+    static_assert(sizeof(color) == 3 * sizeof(double), "colors are reduced as doubles");
+  }
+
+  // traces until all ranks are done, returns the seconds this rank was idle
+  double run(int num_threads)
+  {
+    double idle = 0;
+    double idle_since = -1;
+    long long wave[2] = {0, 0};
+    long long wave_sum[2] = {0, 0};
+    long long last_wave[2] = {-1, -1};
+    MPI_Request wave_request = MPI_REQUEST_NULL;
+
+    while(true)
+      {
+        receive();
+        complete_sends(false);
+        if(work.empty())
+          generate_camera_rays();
+        const bool busy = !work.empty();
+        if(busy)
+          trace_round(num_threads);
+        // nothing is held back, so every ray not in work is counted in `sent`
+        send_outgoing();
+
+        if(busy)
+          {
+            if(idle_since >= 0)
+              {
+                idle += omp_get_wtime() - idle_since;
+                idle_since = -1;
+              }
+            continue;
+          }
+        if(idle_since < 0)
+          idle_since = omp_get_wtime();
+        // a rank joins the waves only once all its camera rays are out
+        if(next_y < config.height)
+          {
+            std::this_thread::yield();
+            continue;
+          }
+
+        // Four counter termination: a wave sums every rank's counts while it is
+        // idle, two equal waves with as many rays received as sent mean no ray
+        // moved between them, so none is left anywhere.
+        if(wave_request == MPI_REQUEST_NULL)
+          {
+            wave[0] = sent;
+            wave[1] = received;
+            MPI_Iallreduce(wave, wave_sum, 2, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD, &wave_request);
+          }
+        int done = 0;
+        MPI_Test(&wave_request, &done, MPI_STATUS_IGNORE);
+        if(done)
+          {
+            if(wave_sum[0] == wave_sum[1] && wave_sum[0] == last_wave[0] && wave_sum[1] == last_wave[1])
+              break;
+            last_wave[0] = wave_sum[0];
+            last_wave[1] = wave_sum[1];
+          }
+        else
+          std::this_thread::yield();
+      }
+    idle += omp_get_wtime() - idle_since;
+    complete_sends(true);
+    return idle;
+  }
+
+  color *image() { return sums.data(); }
+  uint64_t bytes_sent() const { return bytes; }
+
+private:
+  struct pending_send
+  {
+    std::vector<ray_message> rays;
+    MPI_Request request;
+  };
+
+  // distance at which the ray of m enters region b in front of its closest hit, false if it does not
+  static bool region_entry(const region_bounds &b, const ray_message &m, double &entry)
+  {
+    if(b.lo[0] > b.hi[0])
+      return false;
+    double t0 = 0;
+    double t1 = m.best_t;
+    for(int a = 0; a < 3 && t0 <= t1; a++)
+      {
+        double inv = 1.0 / m.direction[a];
+        double near = (b.lo[a] - m.origin[a]) * inv;
+        double far = (b.hi[a] - m.origin[a]) * inv;
+        if(near > far)
+          std::swap(near, far);
+        t0 = std::fmax(t0, near);
+        t1 = std::fmin(t1, far);
+      }
+    entry = t0;
+    return t0 <= t1 && t0 < m.best_t;
+  }
+
+  // the first region after (entered, last_rank) the ray enters in front of its closest hit, -1 if none
+  int next_region(const ray_message &m) const
+  {
+    int next = -1;
+    double next_entry = 0;
+    for(int r = 0; r < procs; r++)
+      {
+        double entry = 0;
+        if(!region_entry(regions[r], m, entry))
+          continue;
+        bool after_last = entry > m.entered || (entry == m.entered && r > m.last_rank);
+        if(after_last && (next < 0 || entry < next_entry))
+          {
+            next = r;
+            next_entry = entry;
+          }
+      }
+    return next;
+  }
+
+  // a new ray from the start of a path or a bounce, routed to the first region it enters
+  int start_ray(ray_message &m, const ray &r, const color &weight, uint64_t random, int pixel, int depth)
+  {
+    for(int a = 0; a < 3; a++)
+      {
+        m.origin[a] = r.origin()[a];
+        m.direction[a] = r.direction()[a];
+        m.weight[a] = weight[a];
+      }
+    m.best_t = DBL_MAX;
+    m.entered = -DBL_MAX;
+    m.random = random;
+    m.pixel = pixel;
+    m.depth = depth;
+    m.best_rank = -1;
+    m.last_rank = -1;
+    m.shade = 0;
+    m.unused = 0;
+    if(depth <= 0)
+      return -1;
+    int next = next_region(m);
+    if(next < 0)
+      add_background(m);
+    return next;
+  }
+
+  void add_background(const ray_message &m)
+  {
+    vec3 unit_direction = unit_vector(vec3(m.direction[0], m.direction[1], m.direction[2]));
+    auto t = 0.5 * (unit_direction.y() + 1.0);
+    color background = (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
+    double *pixel = sums[m.pixel].e;
+    for(int a = 0; a < 3; a++)
+      {
+#pragma omp atomic
+        pixel[a] += m.weight[a] * background[a];
+      }
+  }
+
+  // advances m by one step on this rank, returns the rank it goes to next or -1 once it is done
+  int step(ray_message &m)
+  {
+    ray r(point3(m.origin[0], m.origin[1], m.origin[2]), vec3(m.direction[0], m.direction[1], m.direction[2]));
+    BVH *world = scene.world();
+    hit_record rec;
+    Sphere *hitObject = nullptr;
+
+    if(m.shade)
+      {
+        // the closest hit is ours, so the local closest hit is the one found before
+        world->intersect(r, &hitObject, rec);
+        ray scattered;
+        color attenuation;
+        use_random_counter(&m.random);
+        bool scatters = rec.mat_ptr->scatter(r, rec, attenuation, scattered);
+        use_random_counter(nullptr);
+        if(!scatters)
+          return -1;
+        color weight(m.weight[0] * attenuation[0], m.weight[1] * attenuation[1], m.weight[2] * attenuation[2]);
+        return start_ray(m, scattered, weight, m.random, m.pixel, m.depth - 1);
+      }
+
+    // the entry next_region found when it routed the ray here
+    double entry = 0;
+    region_entry(regions[rank], m, entry);
+    if(world != nullptr && world->intersect(r, &hitObject, rec) && rec.t < m.best_t)
+      {
+        m.best_t = rec.t;
+        m.best_rank = rank;
+      }
+    m.entered = entry;
+    m.last_rank = rank;
+
+    int next = next_region(m);
+    if(next >= 0)
+      return next;
+    if(m.best_rank < 0)
+      {
+        add_background(m);
+        return -1;
+      }
+    m.shade = 1;
+    return m.best_rank;
+  }
+
+  void trace_round(int num_threads)
+  {
+    const size_t n = std::min(work.size(), round_rays);
+    std::vector<ray_message> batch(work.end() - n, work.end());
+    work.resize(work.size() - n);
+    std::vector<int> destination(n);
+
+#pragma omp parallel for schedule(dynamic, 16) num_threads(num_threads)
+    for(size_t k = 0; k < n; k++)
+      destination[k] = step(batch[k]);
+
+    for(size_t k = 0; k < n; k++)
+      route(batch[k], destination[k]);
+  }
+
+  void route(const ray_message &m, int destination)
+  {
+    if(destination == rank)
+      work.push_back(m);
+    else if(destination >= 0)
+      {
+        outgoing[destination].push_back(m);
+        outgoing_rays++;
+      }
+  }
+
+  // sends the rays waiting for every other rank
+  void send_outgoing()
+  {
+    for(int r = 0; r < procs; r++)
+      if(!outgoing[r].empty())
+        {
+          sends.emplace_back();
+          pending_send &p = sends.back();
+          p.rays.swap(outgoing[r]);
+          const int count = static_cast<int>(p.rays.size() * sizeof(ray_message));
+          MPI_Isend(p.rays.data(), count, MPI_BYTE, r, ray_tag, MPI_COMM_WORLD, &p.request);
+          sent += p.rays.size();
+          in_flight += p.rays.size();
+          bytes += count;
+        }
+    outgoing_rays = 0;
+  }
+
+  void receive()
+  {
+    while(work.size() < max_queued)
+      {
+        int flag = 0;
+        MPI_Status status;
+        MPI_Iprobe(MPI_ANY_SOURCE, ray_tag, MPI_COMM_WORLD, &flag, &status);
+        if(!flag)
+          return;
+        int count = 0;
+        MPI_Get_count(&status, MPI_BYTE, &count);
+        const size_t n = count / sizeof(ray_message);
+        const size_t start = work.size();
+        work.resize(start + n);
+        MPI_Recv(&work[start], count, MPI_BYTE, status.MPI_SOURCE, ray_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        received += n;
+      }
+  }
+
+  void complete_sends(bool wait)
+  {
+    for(auto it = sends.begin(); it != sends.end();)
+      {
+        int done = 0;
+        if(wait)
+          MPI_Wait(&it->request, MPI_STATUS_IGNORE);
+        else
+          MPI_Test(&it->request, &done, MPI_STATUS_IGNORE);
+        if(wait || done)
+          {
+            in_flight -= it->rays.size();
+            it = sends.erase(it);
+          }
+        else
+          ++it;
+      }
+  }
+
+  // camera rays of this rank's rows, y = rank, rank + procs, ..., a few pixels at a
+  // time; at most a round's worth of them waits here or in `outgoing`, and none
+  // while the sends of earlier ones are still under way
+  void generate_camera_rays()
+  {
+    const camera &cam = config.cam;
+    const int samples = config.samplePerPixel;
+    while(work.size() + outgoing_rays < round_rays && in_flight < max_in_flight && next_y < config.height)
+      {
+        const int j = config.height - 1 - next_y;
+        const int pixel = next_y * config.width + next_x;
+        // the path of sample s starts its counter at mix_seed(pixel's stream, s)
+        const uint64_t pixel_stream = mix_seed(mix_seed(mix_seed(config.seed, config.pass), j), next_x);
+        for(int s = 0; s < samples; s++)
+          {
+            uint64_t random = mix_seed(pixel_stream, s);
+            use_random_counter(&random);
+            auto u = (next_x + random_double()) / (config.width - 1);
+            auto v = (j + random_double()) / (config.height - 1);
+            ray camera_ray = cam.get_ray(u, v);
+            use_random_counter(nullptr);
+            ray_message m;
+            route(m, start_ray(m, camera_ray, color(1, 1, 1), random, pixel, config.traceDepth));
+          }
+        if(++next_x == config.width)
+          {
+            next_x = 0;
+            next_y += procs;
+          }
+      }
+  }
+
+  const traceConfig &config;
+  scene_partition &scene;
+  const std::vector<region_bounds> &regions;
+  const int procs;
+  const int rank;
+  std::vector<color> sums;
+  std::vector<ray_message> work;
+  std::vector<std::vector<ray_message>> outgoing;
+  std::list<pending_send> sends;
+  size_t outgoing_rays = 0; // in `outgoing`
+  size_t in_flight = 0;     // in `sends`
+  long long sent = 0;
+  long long received = 0;
+  uint64_t bytes = 0;
+  int next_y = config.myRank;
+  int next_x = 0;
+};
+}
+
+frame_times render_data_parallel(const traceConfig &config, scene_partition &scene, int num_threads,
+                                 const std::function<void(const color *)> &on_complete)
+{
+  MPI_Barrier(MPI_COMM_WORLD);
+  double tstart = omp_get_wtime();
+
+  data_parallel_renderer renderer(config, scene);
+  double idle = renderer.run(num_threads);
+  double rendered = omp_get_wtime();
+
+  double *data = renderer.image()->e;
+  const int count = 3 * config.width * config.height;
+  if(config.myRank == 0)
+    MPI_Reduce(MPI_IN_PLACE, data, count, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  else
+    MPI_Reduce(data, nullptr, count, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  if(config.myRank == 0)
+    on_complete(renderer.image());
+
+  frame_times times;
+  times.render = rendered - tstart;
+  times.all = omp_get_wtime() - tstart;
+  times.bytesSent = renderer.bytes_sent();
+  times.idle = idle;
+  times.prepass = 0;
+  return times;
+}
@@ -0,0 +1,64 @@
+#ifndef __H_MPI_DATA_PARALLEL__
+#define __H_MPI_DATA_PARALLEL__
+
+#include <mpi.h>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "mpi_render.h"
+
+// axis aligned bounds of the spheres one rank owns, empty when lo > hi
+struct region_bounds
+{
+    double lo[3];
+    double hi[3];
+};
+
+/**
+ * @brief this rank's spatial share of a scene too large to be held by every rank.
+ *
+ * The spheres are ordered by the Morton code of their centres, the order of the
+ * octree's leaves, and every rank keeps a contiguous run of that order, so the
+ * regions are compact and cover the scene's volume roughly evenly. No rank holds
+ * more than its share: each one reads a block of the scene by index, and the
+ * spheres are sent to their owners along splitters sampled from all blocks, which
+ * keeps every run within about twice the even share. The rank builds its BVH over
+ * its own spheres only and learns the bounds of every other region.
+ */
+class scene_partition
+{
+public:
+    // collective over comm; `block` holds this rank's block of the scene's spheres,
+    // [total * rank / procs, total * (rank + 1) / procs), and is deleted and emptied
+    scene_partition(std::vector<Sphere *> &block, uint64_t total, MPI_Comm comm);
+    ~scene_partition();
+    scene_partition(const scene_partition &) = delete;
+    scene_partition &operator=(const scene_partition &) = delete;
+
+    // nullptr if this rank owns no sphere
+    BVH *world() { return local_world.get(); }
+    const std::vector<region_bounds> &regions() const { return bounds; }
+    size_t local_spheres() const { return owned.size(); }
+    size_t total_spheres() const { return total; }
+
+private:
+    std::vector<Sphere *> owned;
+    std::unique_ptr<BVH> local_world;
+    std::vector<region_bounds> bounds;
+    size_t total = 0;
+};
+
+/**
+ * @brief render one frame with the scene partitioned over the ranks. Each rank
+ * generates the camera rays of its share of the rows; a ray visits the regions it
+ * crosses in order of entry, nearest first, until its closest hit so far lies in
+ * front of the next one. The owner of the hit scatters it and the scattered ray
+ * starts over. Rays travel between ranks in batches; the frame ends once every
+ * rank is idle and all rays sent have been received.
+ * `on_complete` runs on rank 0 with the per-pixel sums of the whole frame.
+ * frame_times::bytesSent counts the ray batches sent by this rank.
+ */
+frame_times render_data_parallel(const traceConfig &config, scene_partition &scene, int num_threads,
+                                 const std::function<void(const color *)> &on_complete);
+
+#endif
@@ -0,0 +1,1029 @@
+#include "mpi_render.h"
+#include "bvh.hpp"
+#include "boundable.h"
+#include "task_pool.h"
+#include <omp.h>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+// random stream of row j, the same for every schedule
+static uint64_t row_stream(const traceConfig &config, int j)
+{
+  return mix_seed(mix_seed(config.seed, config.pass), j);
+}
+
+// random stream of the pixels of row j from column x0 on; a whole row keeps the row's
+static uint64_t span_stream(const traceConfig &config, int j, int x0)
+{
+  return x0 == 0 ? row_stream(config, j) : mix_seed(row_stream(config, j), x0);
+}
+
+// sums of `samples` samples for pixels x0..x0+w of row j, drawn from `stream`
+static void trace_span(const traceConfig &config, BVH &world, int j, int x0, int w, int samples,
+                       uint64_t stream, color *out)
+{
+  reseed_generator(stream);
+  for(int i = x0; i < x0 + w; i++)
+    out[i - x0] = render_pixel(config, world, i, j, samples);
+}
+
+// pixels [x0, x0 + w) x [y0, y0 + h) of the image, y0 counted from the top row
+struct pixel_rect
+{
+  int x0;
+  int y0;
+  int w;
+  int h;
+};
+
+// index along the Hilbert curve through an n x n grid, n a power of two, of cell (x, y)
+static int64_t hilbert_index(int64_t n, int64_t x, int64_t y)
+{
+  int64_t d = 0;
+  for(int64_t s = n / 2; s > 0; s /= 2)
+    {
+      const int64_t rx = (x & s) > 0;
+      const int64_t ry = (y & s) > 0;
+      d += s * s * ((3 * rx) ^ ry);
+      if(ry == 0)
+        {
+          if(rx == 1)
+            {
+              x = s - 1 - x;
+              y = s - 1 - y;
+            }
+          std::swap(x, y);
+        }
+    }
+  return d;
+}
+
+// The units of work the schedulers hand out: image rows, unit j being row j
+// counted from the bottom, or square tiles numbered along a Hilbert curve so
+// that a range of units covers a compact part of the image.
+class work_layout
+{
+public:
+  work_layout(const traceConfig &config, int tile_size)
+    : width(config.width), height(config.height), tile(tile_size)
+  {
+    if(tile <= 0)
+      return;
+    const int tiles_x = (width + tile - 1) / tile;
+    const int tiles_y = (height + tile - 1) / tile;
+    int64_t n = 1;
+    while(n < std::max(tiles_x, tiles_y))
+      n *= 2;
+    std::vector<std::pair<int64_t, pixel_rect>> order;
+    for(int ty = 0; ty < tiles_y; ty++)
+      for(int tx = 0; tx < tiles_x; tx++)
+        {
+          pixel_rect r{tx * tile, ty * tile, std::min(tile, width - tx * tile), std::min(tile, height - ty * tile)};
+          order.emplace_back(hilbert_index(n, tx, ty), r);
+        }
+    std::sort(order.begin(), order.end(),
+              [](const std::pair<int64_t, pixel_rect> &a, const std::pair<int64_t, pixel_rect> &b)
+              { return a.first < b.first; });
+    for(auto &o : order)
+      tiles.push_back(o.second);
+  }
+
+  bool tiled() const { return !tiles.empty(); }
+  int count() const { return tiled() ? static_cast<int>(tiles.size()) : height; }
+
+  pixel_rect rect(int unit) const
+  {
+    return tiled() ? tiles[unit] : pixel_rect{0, height - 1 - unit, width, 1};
+  }
+
+private:
+  int width;
+  int height;
+  int tile;
+  std::vector<pixel_rect> tiles;
+};
+
+// units [start, end) of the frame's work_layout: rows, row 0 being the bottom
+// one, or tiles
+struct row_range
+{
+  int start;
+  int end;
+  bool empty() const { return start >= end; }
+};
+
+// the requesting rank's rows per second over the mean of the rates the ranks
+// last reported, `rate_sum` over `reporting` ranks; every rate is measured from
+// rows its rank completed, so rows still rendering do not count. 1 while unknown.
+static double relative_speed(double rows_per_second, double rate_sum, int64_t reporting)
+{
+  return rows_per_second > 0 && rate_sum > 0 && reporting > 0 ? rows_per_second * reporting / rate_sum : 1.0;
+}
+
+// Hands out row ranges to this rank, one thread at a time. After a non-empty
+// claim() the renderer calls post() to ask for the following range while the
+// current one renders; claim() then completes that request. Schedulers take
+// mpi_mutex around single MPI calls, at most a one-sided operation and its
+// flush, and never hold it while waiting for a lock or a message of another
+// rank, so rows can be put into rank 0's window meanwhile.
+class row_scheduler
+{
+public:
+  virtual ~row_scheduler() {}
+  // start fetching the next range, if the scheduler can do so asynchronously
+  virtual void post() {}
+  // an empty range once the frame is exhausted
+  virtual row_range claim() = 0;
+
+  // MPI_THREAD_SERIALIZED: one thread in MPI at a time
+  std::mutex mpi_mutex;
+  // rows per second this rank rendered so far, set by the renderer before claims
+  double throughput = 0;
+
+protected:
+  // wait for requests, polling with the MPI mutex released in between
+  void wait(MPI_Request *requests, int count)
+  {
+    for(;;)
+      {
+        int done = 0;
+        {
+          std::lock_guard<std::mutex> lock(mpi_mutex);
+          MPI_Testall(count, requests, &done, MPI_STATUSES_IGNORE);
+        }
+        if(done)
+          return;
+        std::this_thread::yield();
+      }
+  }
+};
+
+// The global distributor on rank 0. A progress thread answers the work
+// requests of the other ranks in serve(), the only MPI calls rank 0 makes while
+// rendering, and rank 0's own render threads take their assignments from
+// assign() directly.
+class work_distributor
+{
+public:
+  work_distributor(const traceConfig &config, int total_rows, int minimum_assignment,
+                   const render_schedule &schedule)
+    : total_rows(total_rows), remaining_rows(total_rows), num_procs(config.numProcs),
+      minimum_assignment(num_procs == 1 ? total_rows : minimum_assignment), schedule(schedule),
+      rates(num_procs, 0.0)
+  {}
+
+  // the next rows for `rank`, rendering rows_per_second, an empty range once
+  // the frame is done
+  row_range assign(int rank, double rows_per_second)
+  {
+    std::lock_guard<std::mutex> lock(assign_mutex);
+    rates[rank] = rows_per_second;
+    double rate_sum = 0;
+    int reporting = 0;
+    for(double rate : rates)
+      if(rate > 0)
+        {
+          rate_sum += rate;
+          reporting++;
+        }
+    double speed = relative_speed(rows_per_second, rate_sum, reporting);
+    int num_rows = chunk_size(schedule, total_rows, remaining_rows, num_procs, minimum_assignment, speed);
+    row_range rows{next_row, next_row + num_rows};
+    next_row += num_rows;
+    remaining_rows -= num_rows;
+    return rows;
+  }
+
+  // answers requests until every other rank got its empty range
+  void serve()
+  {
+    int finish_messages_distributed = 0;
+    // the requesting rank and its rows per second
+    double incoming_request_buf[2];
+    int outgoing_request_buf[2];
+
+    while(finish_messages_distributed < num_procs - 1)
+      {
+        // receive a work request from some process, polling so that the
+        // thread leaves the core to the render threads while it waits
+        MPI_Request request;
+        MPI_Irecv(incoming_request_buf,
+                  2, MPI_DOUBLE,
+                  MPI_ANY_SOURCE,
+                  MPI_ANY_TAG,
+                  MPI_COMM_WORLD,
+                  &request
+                  );
+        int received = 0;
+        for(;;)
+          {
+            MPI_Test(&request, &received, MPI_STATUS_IGNORE);
+            if(received)
+              break;
+            std::this_thread::yield();
+          }
+
+        int requesting_process = static_cast<int>(incoming_request_buf[0]);
+        row_range rows = assign(requesting_process, incoming_request_buf[1]);
+        outgoing_request_buf[0] = rows.start;
+        outgoing_request_buf[1] = rows.end;
+        if(rows.empty())
+          finish_messages_distributed++;
+
+        MPI_Send(outgoing_request_buf,
+                 2, MPI_INT,
+                 requesting_process, 0,
+                 MPI_COMM_WORLD
+                 );
+      }
+  }
+
+private:
+  const int total_rows;
+  int remaining_rows;
+  const int num_procs;
+  const int minimum_assignment;
+  const render_schedule &schedule;
+  // rows per second each rank reported with its last request, 0 before its first
+  std::vector<double> rates;
+  int next_row = 0;
+  std::mutex assign_mutex;
+};
+
+// rank 0's render threads take assignments from the distributor in memory
+class local_distributor_client : public row_scheduler
+{
+public:
+  explicit local_distributor_client(work_distributor &distributor) : distributor(distributor) {}
+
+  row_range claim() override { return distributor.assign(0, throughput); }
+
+private:
+  work_distributor &distributor;
+};
+
+// asks the distributor on rank 0 for every assignment, the next one as soon as
+// the current one arrives
+class distributor_client : public row_scheduler
+{
+public:
+  explicit distributor_client(int my_rank) : rank(my_rank) {}
+
+  void post() override
+  {
+    std::lock_guard<std::mutex> lock(mpi_mutex);
+    request_data[0] = rank;
+    request_data[1] = throughput;
+    MPI_Isend(request_data,
+              2, MPI_DOUBLE,
+              0, 0,
+              MPI_COMM_WORLD,
+              &requests[0]
+              );
+    MPI_Irecv(received_data,
+              2, MPI_INT,
+              0, 0,
+              MPI_COMM_WORLD,
+              &requests[1]
+              );
+    posted = true;
+  }
+
+  row_range claim() override
+  {
+    if(!posted)
+      post();
+    wait(requests, 2);
+    posted = false;
+    return row_range{received_data[0], received_data[1]};
+  }
+
+private:
+  int rank;
+  double request_data[2];
+  int received_data[2];
+  MPI_Request requests[2];
+  bool posted = false;
+};
+
+// Ranks claim rows by adding to a shared counter of assigned rows on rank 0,
+// so no rank has to serve requests. The guided size comes from a plain read of
+// the counter and the rows are taken with one atomic add, so a claim never
+// retries; a rank that raced another just starts further on. A posted claim
+// sizes its rows from the counter as this rank last saw it and is sent as a
+// request-based MPI_Rget_accumulate. The same add reports this rank's rows per
+// second, which the adaptive policy compares with the mean reported rate.
+class rma_scheduler : public row_scheduler
+{
+public:
+  rma_scheduler(int total_rows, int num_procs, int minimum, int my_rank, const render_schedule &schedule)
+    : total(total_rows), procs(num_procs), minimum_rows(minimum), schedule(schedule)
+  {
+    int64_t *counters = nullptr;
+    MPI_Win_allocate(my_rank == 0 ? num_counters * sizeof(int64_t) : 0, sizeof(int64_t),
+                     MPI_INFO_NULL, MPI_COMM_WORLD, &counters, &window);
+    if(my_rank == 0)
+      {
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, window);
+        std::fill(counters, counters + num_counters, 0);
+        MPI_Win_unlock(0, window);
+      }
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Win_lock_all(0, window);
+  }
+
+  ~rma_scheduler()
+  {
+    MPI_Win_unlock_all(window);
+    MPI_Win_free(&window);
+  }
+
+  void post() override
+  {
+    if(seen >= total)
+      return;
+    prepare_claim();
+    std::lock_guard<std::mutex> lock(mpi_mutex);
+    MPI_Rget_accumulate(added, num_counters, MPI_INT64_T, found, num_counters, MPI_INT64_T,
+                        0, 0, num_counters, MPI_INT64_T, MPI_SUM, window, &request);
+    posted = true;
+  }
+
+  row_range claim() override
+  {
+    if(posted)
+      {
+        wait(&request, 1);
+        posted = false;
+        return taken();
+      }
+
+    std::lock_guard<std::mutex> lock(mpi_mutex);
+    MPI_Get_accumulate(nullptr, 0, MPI_INT64_T, found, num_counters, MPI_INT64_T,
+                       0, 0, num_counters, MPI_INT64_T, MPI_NO_OP, window);
+    MPI_Win_flush(0, window);
+    seen = found[assigned];
+    rate_sum = found[rates];
+    reporting = found[reporters];
+    if(seen >= total)
+      return row_range{total, total};
+
+    prepare_claim();
+    MPI_Get_accumulate(added, num_counters, MPI_INT64_T, found, num_counters, MPI_INT64_T,
+                       0, 0, num_counters, MPI_INT64_T, MPI_SUM, window);
+    MPI_Win_flush(0, window);
+    return taken();
+  }
+
+private:
+  // rank 0's window: rows assigned, the sum of the ranks' last reported rates in
+  // thousandths of a row per second, and how many ranks reported one
+  enum counter { assigned, rates, reporters, num_counters };
+
+  // the rows to ask for, and our rate replacing the one we reported before
+  void prepare_claim()
+  {
+    const double speed = relative_speed(throughput, rate_sum / 1e3, reporting);
+    added[assigned] = chunk_size(schedule, total, total - seen, procs, minimum_rows, speed);
+    const int64_t rate = static_cast<int64_t>(throughput * 1e3);
+    added[rates] = rate > 0 ? rate - reported_rate : 0;
+    added[reporters] = rate > 0 && reported_rate == 0 ? 1 : 0;
+    if(rate > 0)
+      reported_rate = rate;
+  }
+
+  // the rows the atomic add of `added` obtained, found holding the counters before it
+  row_range taken()
+  {
+    const int64_t start = found[assigned];
+    seen = start + added[assigned];
+    rate_sum = found[rates] + added[rates];
+    reporting = found[reporters] + added[reporters];
+    if(start >= total)
+      return row_range{total, total};
+    return row_range{static_cast<int>(start), static_cast<int>(std::min<int64_t>(seen, total))};
+  }
+
+  MPI_Win window;
+  int total;
+  int procs;
+  int minimum_rows;
+  const render_schedule &schedule;
+  // the counters as of our last claim
+  int64_t seen = 0;
+  int64_t rate_sum = 0;
+  int64_t reporting = 0;
+  int64_t reported_rate = 0;
+  int64_t added[num_counters] = {0, 0, 0};
+  int64_t found[num_counters] = {0, 0, 0};
+  MPI_Request request;
+  bool posted = false;
+};
+
+// Every rank starts with a contiguous block of rows and renders it front to
+// back in small chunks. A rank whose block is empty steals the back half of the
+// rows left to a random victim, trying a rank on its own node before any other,
+// so both keep working on neighbouring rows. Blocks live in a window of one
+// word per rank holding {next, end}, changed only by single fetch-and-op calls
+// in a lock_all epoch, so neither the owner nor a thief ever waits for another
+// rank's lock. A counter of unclaimed rows on rank 0 ends the search; it
+// only drops when rows are claimed for rendering, so rows in transit between a
+// victim and a thief still keep the others looking.
+class steal_scheduler : public row_scheduler
+{
+public:
+  steal_scheduler(const traceConfig &config, int total, int chunk)
+    : rank(config.myRank), procs(config.numProcs), chunk_rows(chunk),
+      generator(mix_seed(mix_seed(config.seed, config.pass), config.myRank))
+  {
+    int64_t *block = nullptr;
+    MPI_Win_allocate(sizeof(int64_t), sizeof(int64_t), MPI_INFO_NULL, MPI_COMM_WORLD, &block, &blocks);
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, blocks);
+    *block = pack(static_cast<int64_t>(total) * rank / procs, static_cast<int64_t>(total) * (rank + 1) / procs);
+    MPI_Win_unlock(rank, blocks);
+
+    int64_t *counter = nullptr;
+    MPI_Win_allocate(rank == 0 ? sizeof(int64_t) : 0, sizeof(int64_t),
+                     MPI_INFO_NULL, MPI_COMM_WORLD, &counter, &unclaimed);
+    if(rank == 0)
+      {
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, unclaimed);
+        *counter = total;
+        MPI_Win_unlock(0, unclaimed);
+      }
+
+    // the other ranks on this node are the preferred victims
+    MPI_Comm node;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node);
+    int node_size = 0;
+    MPI_Comm_size(node, &node_size);
+    std::vector<int> node_ranks(node_size);
+    MPI_Allgather(&rank, 1, MPI_INT, node_ranks.data(), 1, MPI_INT, node);
+    MPI_Comm_free(&node);
+    for(int r : node_ranks)
+      if(r != rank)
+        node_peers.push_back(r);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Win_lock_all(0, blocks);
+    MPI_Win_lock_all(0, unclaimed);
+  }
+
+  ~steal_scheduler()
+  {
+    MPI_Win_unlock_all(blocks);
+    MPI_Win_unlock_all(unclaimed);
+    MPI_Win_free(&unclaimed);
+    MPI_Win_free(&blocks);
+  }
+
+  // mpi_mutex is taken per operation, so other threads can send rows between
+  // the steal attempts
+  row_range claim() override
+  {
+    for(;;)
+      {
+        row_range rows = take_front();
+        if(!rows.empty())
+          {
+            add_unclaimed(rows.start - rows.end);
+            return rows;
+          }
+
+        if(add_unclaimed(0) <= 0)
+          return row_range{0, 0};
+
+        rows = steal();
+        if(!rows.empty())
+          store(rows);
+        else
+          std::this_thread::yield();
+      }
+  }
+
+private:
+  // adds delta to the unclaimed rows, returns the count before
+  int64_t add_unclaimed(int64_t delta)
+  {
+    int64_t left = 0;
+    std::lock_guard<std::mutex> lock(mpi_mutex);
+    if(delta == 0)
+      MPI_Fetch_and_op(nullptr, &left, MPI_INT64_T, 0, 0, MPI_NO_OP, unclaimed);
+    else
+      MPI_Fetch_and_op(&delta, &left, MPI_INT64_T, 0, 0, MPI_SUM, unclaimed);
+    MPI_Win_flush(0, unclaimed);
+    return left;
+  }
+
+  // A block is end * 2^32 + next. The owner adds to next and thieves subtract
+  // from end, each learning from the word it replaced which rows it got, so
+  // concurrent claims never overlap. Either may pass the other, which leaves
+  // the block empty; a borrow from a negative end only leaves the top bits.
+  static int64_t pack(int64_t next, int64_t end) { return end * (int64_t(1) << 32) + next; }
+  static int64_t next_of(int64_t word) { return word & 0xffffffff; }
+  static int64_t end_of(int64_t word) { return word >> 32; }
+
+  int64_t fetch_and_op(int owner, int64_t operand, MPI_Op op)
+  {
+    int64_t word = 0;
+    std::lock_guard<std::mutex> lock(mpi_mutex);
+    MPI_Fetch_and_op(op == MPI_NO_OP ? nullptr : &operand, &word, MPI_INT64_T, owner, 0, op, blocks);
+    MPI_Win_flush(owner, blocks);
+    return word;
+  }
+
+  // our block is empty when it is refilled; a thief that still takes from it
+  // gets rows of the new block
+  void store(const row_range &rows)
+  {
+    fetch_and_op(rank, pack(rows.start, rows.end), MPI_REPLACE);
+    drained = false;
+  }
+
+  // the next chunk of our block; only store() refills it, so once it ran dry it
+  // is not asked again, and next does not keep growing while we look for victims
+  row_range take_front()
+  {
+    if(drained)
+      return row_range{0, 0};
+    int64_t word = fetch_and_op(rank, chunk_rows, MPI_SUM);
+    int64_t next = next_of(word);
+    row_range rows{static_cast<int>(next), static_cast<int>(std::max(next, std::min(next + chunk_rows, end_of(word))))};
+    drained = rows.empty();
+    return rows;
+  }
+
+  // the back half of a random victim's block, empty if it had none left
+  row_range steal()
+  {
+    if(procs == 1)
+      return row_range{0, 0};
+    int victim;
+    if(!node_peers.empty() && !tried_node)
+      victim = node_peers[std::uniform_int_distribution<size_t>(0, node_peers.size() - 1)(generator)];
+    else
+      {
+        victim = std::uniform_int_distribution<int>(0, procs - 2)(generator);
+        victim += victim >= rank;
+      }
+
+    // half of what the victim had a moment ago, cut to what is left when it is taken
+    int64_t word = fetch_and_op(victim, 0, MPI_NO_OP);
+    int64_t half = (end_of(word) - next_of(word) + 1) / 2;
+    row_range rows{0, 0};
+    if(half > 0)
+      {
+        word = fetch_and_op(victim, -pack(0, half), MPI_SUM);
+        int64_t end = end_of(word), start = std::max(next_of(word), end - half);
+        if(start < end)
+          rows = row_range{static_cast<int>(start), static_cast<int>(end)};
+      }
+    // an empty node neighbour sends the next attempt off the node
+    tried_node = rows.empty() && !tried_node;
+    return rows;
+  }
+
+  int rank;
+  int procs;
+  int chunk_rows;
+  std::mt19937_64 generator;
+  std::vector<int> node_peers;
+  bool tried_node = false;
+  bool drained = false;
+  MPI_Win blocks;
+  MPI_Win unclaimed;
+};
+
+// Hands out a fixed block of rows in chunks, without talking to other ranks.
+class block_scheduler : public row_scheduler
+{
+public:
+  block_scheduler(row_range block, int chunk) : rows(block), chunk_rows(chunk) {}
+
+  row_range claim() override
+  {
+    row_range chunk{rows.start, std::min(rows.start + chunk_rows, rows.end)};
+    rows.start = chunk.end;
+    return chunk.empty() ? row_range{0, 0} : chunk;
+  }
+
+private:
+  row_range rows;
+  int chunk_rows;
+};
+
+// Times every unit of a preview with one sample for every preview_stride-th
+// pixel of each row, the units split round robin over the ranks, and returns
+// the block of units of equal estimated cost for each rank.
+static std::vector<int> cost_partition(const traceConfig &config, BVH &world, const work_layout &layout,
+                                       int num_threads)
+{
+  const int preview_stride = 8;
+  const int image_width = config.width;
+  const int image_height = config.height;
+  const int units = layout.count();
+  std::vector<double> cost(units, 0.0);
+
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+  for(int unit = config.myRank; unit < units; unit += config.numProcs)
+    {
+      double start = omp_get_wtime();
+      const pixel_rect r = layout.rect(unit);
+      for(int y = r.y0; y < r.y0 + r.h; y++)
+        {
+          const int j = image_height - 1 - y;
+          reseed_generator(mix_seed(span_stream(config, j, r.x0), image_height));
+          for(int i = r.x0 + preview_stride / 2; i < r.x0 + r.w; i += preview_stride)
+            render_pixel(config, world, i, j, 1);
+        }
+      cost[unit] = omp_get_wtime() - start;
+    }
+  MPI_Allreduce(MPI_IN_PLACE, cost.data(), units, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  return balancedPartition(cost, config.numProcs);
+}
+
+// Renders the units this rank is assigned as tasks of a task_pool with
+// num_threads workers, one task per row or tile. Whenever fewer units than
+// workers are queued, a refill task claims the next assignment and queues its
+// units, while the workers keep rendering the units still queued; as soon as an
+// assignment arrives the one after it is posted. No worker waits for the others
+// between assignments. Rows are put into rank 0's window by whichever thread
+// completes the last row of an assignment, all of them in one transfer since
+// they are adjacent; tiles are put one by one as they are done, through a
+// strided datatype. Neither waits for the transfer.
+class rank_renderer
+{
+public:
+  rank_renderer(const traceConfig &config, BVH &world, const work_layout &layout, unsigned char *image,
+                MPI_Win window, row_scheduler &scheduler)
+    : config(config), world(world), layout(layout), image(image), window(window), scheduler(scheduler),
+      pixel_size(wire_pixel_size(config.wire))
+  {}
+
+  ~rank_renderer()
+  {
+    for(auto &t : tile_types)
+      MPI_Type_free(&t.second);
+  }
+
+  // returns the bytes put into rank 0's window
+  uint64_t run(int num_threads)
+  {
+    task_pool pool(num_threads);
+    run_start = omp_get_wtime();
+    low_water = pool.size();
+    refilling = true;
+    pool.submit([this, &pool] { refill(pool); });
+    pool.wait_idle();
+    return bytes_sent;
+  }
+
+  // seconds all threads together spent rendering
+  double busy_seconds() const { return busy_ns * 1e-9; }
+
+private:
+  struct assignment
+  {
+    explicit assignment(row_range r) : rows(r), unfinished(r.end - r.start) {}
+    row_range rows;
+    std::atomic_int unfinished;
+  };
+
+  // claims the next assignment and queues its units, the first one on top;
+  // never claims again once the scheduler ran out of units
+  void refill(task_pool &pool)
+  {
+    scheduler.throughput = rows_done / std::max(omp_get_wtime() - run_start, 1e-9);
+    row_range rows = exhausted ? row_range{0, 0} : scheduler.claim();
+    if(rows.empty())
+      {
+        exhausted = true;
+        refilling = false;
+        return;
+      }
+    scheduler.post();
+    auto work = std::make_shared<assignment>(rows);
+    for(int unit = rows.end - 1; unit >= rows.start; unit--)
+      pool.submit([this, &pool, work, unit] { render_task(pool, work, unit); });
+    refilling = false;
+  }
+
+  void render_task(task_pool &pool, const std::shared_ptr<assignment> &work, int unit)
+  {
+    double start = omp_get_wtime();
+    const pixel_rect rect = layout.rect(unit);
+    render_rect(rect);
+    busy_ns += static_cast<int64_t>((omp_get_wtime() - start) * 1e9);
+    rows_done++;
+    if(layout.tiled())
+      send_tile(rect);
+    else if(--work->unfinished == 0)
+      send_rows(work->rows);
+    if(!exhausted && pool.queued() < low_water && !refilling.exchange(true))
+      pool.submit([this, &pool] { refill(pool); });
+  }
+
+  void render_rect(const pixel_rect &rect)
+  {
+    std::vector<color> span(rect.w);
+    for(int y = rect.y0; y < rect.y0 + rect.h; y++)
+      {
+        const int j = config.height - 1 - y;
+        trace_span(config, world, j, rect.x0, rect.w, config.samplePerPixel, span_stream(config, j, rect.x0),
+                   span.data());
+        unsigned char *out = image + (static_cast<size_t>(y) * config.width + rect.x0) * pixel_size;
+        for(int i = 0; i < rect.w; i++)
+          encode_wire_pixel(config.wire, span[i], config.samplePerPixel, out + i * pixel_size);
+      }
+  }
+
+  // rank 0 renders straight into its window
+  void send_rows(const row_range &rows)
+  {
+    if(config.myRank == 0)
+      return;
+    const size_t offset = static_cast<size_t>(config.height - rows.end) * config.width * pixel_size;
+    const size_t bytes = static_cast<size_t>(rows.end - rows.start) * config.width * pixel_size;
+    std::lock_guard<std::mutex> mpi_lock(scheduler.mpi_mutex);
+    MPI_Put(image + offset, bytes, MPI_BYTE, 0, offset, bytes, MPI_BYTE, window);
+    bytes_sent += bytes;
+  }
+
+  void send_tile(const pixel_rect &rect)
+  {
+    if(config.myRank == 0)
+      return;
+    const size_t offset = (static_cast<size_t>(rect.y0) * config.width + rect.x0) * pixel_size;
+    std::lock_guard<std::mutex> mpi_lock(scheduler.mpi_mutex);
+    auto found = tile_types.find(std::make_pair(rect.w, rect.h));
+    if(found == tile_types.end())
+      {
+        // rect.h rows of the tile, a full image row apart
+        MPI_Datatype type;
+        MPI_Type_vector(rect.h, rect.w * pixel_size, config.width * pixel_size, MPI_BYTE, &type);
+        MPI_Type_commit(&type);
+        found = tile_types.emplace(std::make_pair(rect.w, rect.h), type).first;
+      }
+    MPI_Put(image + offset, 1, found->second, 0, offset, 1, found->second, window);
+    bytes_sent += static_cast<uint64_t>(rect.w) * rect.h * pixel_size;
+  }
+
+  const traceConfig &config;
+  BVH &world;
+  const work_layout &layout;
+  unsigned char *image;
+  MPI_Win window;
+  row_scheduler &scheduler;
+  const size_t pixel_size;
+  // tile datatypes by width and height, made under the MPI mutex
+  std::map<std::pair<int, int>, MPI_Datatype> tile_types;
+
+  size_t low_water = 1;
+  double run_start = 0;
+  std::atomic_int rows_done{0};
+  std::atomic_bool refilling{false};
+  std::atomic_bool exhausted{false};
+  std::atomic<uint64_t> bytes_sent{0};
+  std::atomic<int64_t> busy_ns{0};
+};
+
+
+// Renders every pixel of the frame with samples [first, last) of
+// config.samplePerPixel; rank 0 keeps the streams of the row split and the other
+// ranks draw from streams mixed with their rank. The image is cut into segments
+// of rows that are reduced to rank 0 with MPI_Ireduce as soon as they are done,
+// in the same order on every rank, so the reduction overlaps the rendering.
+class sample_renderer
+{
+public:
+  sample_renderer(const traceConfig &config, BVH &world, int first, int last)
+    : config(config), world(world), samples(last - first),
+      sums(static_cast<size_t>(config.width) * config.height),
+      num_segments((config.height + segment_rows - 1) / segment_rows),
+      segment_rows_left(num_segments), requests(num_segments, MPI_REQUEST_NULL)
+  {
+    static_assert(sizeof(color) == 3 * sizeof(double), "colors are reduced as doubles");
+    for(int s = 0; s < num_segments; s++)
+      segment_rows_left[s] = segment_rows_in(s);
+  }
+
+  // returns the seconds all threads together spent rendering
+  double run(int num_threads)
+  {
+    {
+      task_pool pool(num_threads);
+      // workers take their newest task first, so the top rows are queued last
+      for(int y = config.height - 1; y >= 0; y--)
+        pool.submit([this, y] { render_row(y); });
+    }
+    MPI_Waitall(num_segments, requests.data(), MPI_STATUSES_IGNORE);
+    return busy_ns * 1e-9;
+  }
+
+  // the summed frame on rank 0, row 0 at the top
+  const color *image() const { return sums.data(); }
+
+  uint64_t bytes_sent() const { return config.myRank == 0 ? 0 : sums.size() * sizeof(color); }
+
+private:
+  static const int segment_rows = 16;
+
+  int segment_rows_in(int s) const { return std::min(segment_rows, config.height - s * segment_rows); }
+
+  // y counts from the top of the image
+  void render_row(int y)
+  {
+    double start = omp_get_wtime();
+    const int j = config.height - 1 - y;
+    uint64_t stream = row_stream(config, j);
+    if(config.myRank != 0)
+      stream = mix_seed(stream, config.myRank);
+    trace_span(config, world, j, 0, config.width, samples, stream, &sums[static_cast<size_t>(y) * config.width]);
+    busy_ns += static_cast<int64_t>((omp_get_wtime() - start) * 1e9);
+
+    if(--segment_rows_left[y / segment_rows] == 0)
+      post_segments();
+  }
+
+  // reduces the finished segments that follow the ones already posted
+  void post_segments()
+  {
+    std::lock_guard<std::mutex> lock(mpi_mutex);
+    while(next_segment < num_segments && segment_rows_left[next_segment] == 0)
+      {
+        const int s = next_segment++;
+        double *data = sums[static_cast<size_t>(s) * segment_rows * config.width].e;
+        const int count = 3 * segment_rows_in(s) * config.width;
+        if(config.myRank == 0)
+          MPI_Ireduce(MPI_IN_PLACE, data, count, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD, &requests[s]);
+        else
+          MPI_Ireduce(data, nullptr, count, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD, &requests[s]);
+      }
+  }
+
+  const traceConfig &config;
+  BVH &world;
+  const int samples;
+  std::vector<color> sums;
+  const int num_segments;
+  std::vector<std::atomic_int> segment_rows_left;
+  std::vector<MPI_Request> requests;
+  // MPI_THREAD_SERIALIZED: one thread in MPI at a time
+  std::mutex mpi_mutex;
+  int next_segment = 0;
+  std::atomic<int64_t> busy_ns{0};
+};
+
+static frame_times render_samples(const traceConfig &config, BVH &world, int num_threads,
+                                  const std::function<void(const color *)> &on_complete)
+{
+  const int first = static_cast<int>(static_cast<int64_t>(config.samplePerPixel) * config.myRank / config.numProcs);
+  const int last = static_cast<int>(static_cast<int64_t>(config.samplePerPixel) * (config.myRank + 1) / config.numProcs);
+  sample_renderer renderer(config, world, first, last);
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  double tstart = omp_get_wtime();
+  double busy = renderer.run(num_threads) / num_threads;
+  double tend = omp_get_wtime();
+  MPI_Barrier(MPI_COMM_WORLD);
+  double tend_all = omp_get_wtime();
+
+  if(config.myRank == 0)
+    on_complete(renderer.image());
+  return frame_times{tend - tstart, tend_all - tstart, renderer.bytes_sent(), tend_all - tstart - busy, 0};
+}
+
+frame_times render_frame(const traceConfig &config, BVH &world, int num_threads,
+                         const std::function<void(const color *)> &on_complete,
+                         const render_schedule &schedule)
+{
+  if(schedule.split == frame_split::samples)
+    return render_samples(config, world, num_threads, on_complete);
+
+  const int image_width = config.width;
+  const int image_height = config.height;
+  const int num_pixels = image_width * image_height;
+  const size_t pixel_size = wire_pixel_size(config.wire);
+
+  // rank 0 exposes the encoded frame, the other ranks render into a local copy
+  MPI_Win window;
+  unsigned char *output_image = nullptr;
+  std::vector<unsigned char> local_image;
+  MPI_Win_allocate(config.myRank == 0 ? pixel_size * num_pixels : 0, 1,
+                   MPI_INFO_NULL, MPI_COMM_WORLD, &output_image, &window);
+  if(config.myRank == 0)
+    {
+      for(int i = 0; i < num_pixels; i++)
+        {
+          encode_wire_pixel(config.wire, color(255, 0, 255), config.samplePerPixel, output_image + i * pixel_size);
+        }
+    }
+  else
+    {
+      local_image.resize(pixel_size * num_pixels);
+      output_image = local_image.data();
+    }
+
+  // assignments of at least two units per render thread keep all of them busy
+  int minimum_distribution = 2*num_threads;
+  const work_layout layout(config, schedule.tile_size);
+  const int units = layout.count();
+  double prepass = 0;
+  std::unique_ptr<row_scheduler> scheduler;
+  if(schedule.scheduler == work_scheduler::rma)
+    scheduler.reset(new rma_scheduler(units, config.numProcs, minimum_distribution, config.myRank, schedule));
+  else if(schedule.scheduler == work_scheduler::steal)
+    scheduler.reset(new steal_scheduler(config, units, minimum_distribution));
+  else if(schedule.scheduler == work_scheduler::cost)
+    {
+      double prepass_start = omp_get_wtime();
+      std::vector<int> bounds = cost_partition(config, world, layout, num_threads);
+      prepass = omp_get_wtime() - prepass_start;
+      scheduler.reset(new block_scheduler(row_range{bounds[config.myRank], bounds[config.myRank + 1]},
+                                          minimum_distribution));
+    }
+  else if(config.myRank != 0)
+    scheduler.reset(new distributor_client(config.myRank));
+
+  // rank 0 hands out the rows from a progress thread and renders with the other threads
+  std::unique_ptr<work_distributor> distributor;
+  int render_threads = num_threads;
+  if(schedule.scheduler == work_scheduler::distributor && config.myRank == 0)
+    {
+      distributor.reset(new work_distributor(config, units, minimum_distribution, schedule));
+      scheduler.reset(new local_distributor_client(*distributor));
+      render_threads = std::max(1, num_threads - 1);
+    }
+
+  double tstart = omp_get_wtime();
+  MPI_Win_fence(0, window);
+  uint64_t bytes_sent = 0;
+  double busy = 0;
+
+  {
+    std::thread progress;
+    if(distributor)
+      progress = std::thread(&work_distributor::serve, distributor.get());
+    rank_renderer renderer(config, world, layout, output_image, window, *scheduler);
+    bytes_sent = renderer.run(render_threads);
+    busy = renderer.busy_seconds() / render_threads;
+    if(progress.joinable())
+      progress.join();
+  }
+  double tend = omp_get_wtime();
+  MPI_Win_fence(0, window);
+  double t_elapsed = tend - tstart;
+  double tend_all = omp_get_wtime();
+  scheduler.reset();
+
+  if(config.myRank == 0)
+    {
+      std::vector<color> sums(num_pixels);
+#pragma omp parallel for schedule(static)
+      for(int i = 0; i < num_pixels; i++)
+        sums[i] = decode_wire_pixel(config.wire, output_image + i * pixel_size, config.samplePerPixel);
+      on_complete(sums.data());
+    }
+
+  MPI_Win_free(&window);
+
+  return frame_times{t_elapsed + prepass, tend_all - tstart + prepass, bytes_sent,
+                     tend_all - tstart - busy, prepass};
+}
+
+double render_imbalance(const double *busy, int num_procs)
+{
+  double longest = 0;
+  double total = 0;
+  int rendering = 0;
+  for(int i = 0; i < num_procs; i++)
+    {
+      if(busy[i] <= 0)
+        continue;
+      longest = std::max(longest, busy[i]);
+      total += busy[i];
+      rendering++;
+    }
+  return rendering == 0 ? 1.0 : longest * rendering / total;
+}
+
+void render_local(const traceConfig &config, BVH &world, task_pool &pool, color *sums)
+{
+  // workers take their newest task first, so the top rows are queued last
+  for(int y = config.height - 1; y >= 0; y--)
+    pool.submit([&config, &world, sums, y]
+                {
+                  const int j = config.height - 1 - y;
+                  trace_span(config, world, j, 0, config.width, config.samplePerPixel, row_stream(config, j),
+                             &sums[static_cast<size_t>(y) * config.width]);
+                });
+  pool.wait_idle();
+}
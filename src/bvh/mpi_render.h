@@ -0,0 +1,50 @@
+#ifndef __H_MPI_RENDER__
+#define __H_MPI_RENDER__
+
+#include <mpi.h>
+#include <cstdint>
+#include <functional>
+#include "ray_tracing.h"
+#include "render_schedule.h"
+
+class task_pool;
+
+struct frame_times
+{
+    double render;
+    double all;
+    uint64_t bytesSent; // pixel data this rank put into rank 0's window
+    double idle;        // of `all`, the time an average thread of this rank did not render, besides the prepass
+    double prepass;     // of `all`, the cost estimate of work_scheduler::cost
+};
+
+/**
+ * @brief render one frame with config.samplePerPixel samples on all ranks. Rows are
+ * handed out by the chosen scheduler, in guided chunks of a third of the remaining
+ * rows per process, stolen from other ranks' blocks, or fixed in advance from the
+ * cost of the rows in a preview. With schedule.tile_size the unit handed out is a
+ * tile instead of a row, the tiles ordered along a Hilbert curve. Each rank renders them with num_threads threads and puts the
+ * rows, encoded as config.wire, into rank 0's window.
+ * With frame_split::samples each rank instead renders every pixel with a disjoint
+ * share of the samples, from its own random streams, and the sums are reduced to
+ * rank 0 in row segments while the rest of the frame renders.
+ * `on_complete` runs on rank 0 with the decoded per-pixel sums of the whole frame.
+ */
+frame_times render_frame(const traceConfig &config, BVH &world, int num_threads,
+                         const std::function<void(const color *)> &on_complete,
+                         const render_schedule &schedule = render_schedule());
+
+/**
+ * @brief render every pixel of a frame on this rank alone, one task of `pool` per
+ * row, into sums (row 0 at the top). The rows draw from the same random streams
+ * as in render_frame.
+ */
+void render_local(const traceConfig &config, BVH &world, task_pool &pool, color *sums);
+
+/**
+ * @brief the longest rendering time of the ranks over their mean, ranks that did
+ * not render left out; 1 is a perfect balance
+ */
+double render_imbalance(const double *busy, int num_procs);
+
+#endif
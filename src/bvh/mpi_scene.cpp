@@ -0,0 +1,69 @@
+#include "mpi_scene.h"
+#include <algorithm>
+#include <cstring>
+
+static const uint64_t kBroadcastPiece = 256ull << 20;
+
+void broadcast_bytes(char *data, uint64_t size, int root, MPI_Comm comm)
+{
+  for(uint64_t offset = 0; offset < size; offset += kBroadcastPiece)
+    {
+      int piece = static_cast<int>(std::min(kBroadcastPiece, size - offset));
+      MPI_Bcast(data + offset, piece, MPI_BYTE, root, comm);
+    }
+}
+
+void broadcast_buffer(std::vector<char> &buffer, int root, MPI_Comm comm)
+{
+  int rank = 0;
+  MPI_Comm_rank(comm, &rank);
+  uint64_t size = buffer.size();
+  MPI_Bcast(&size, 1, MPI_UINT64_T, root, comm);
+  if(rank != root)
+    buffer.resize(size);
+  broadcast_bytes(buffer.data(), size, root, comm);
+}
+
+node_shared_scene::node_shared_scene(const std::vector<char> &buffer, MPI_Comm comm)
+{
+  int rank = 0;
+  MPI_Comm_rank(comm, &rank);
+  bytes = buffer.size();
+  MPI_Bcast(&bytes, 1, MPI_UINT64_T, 0, comm);
+
+  // ranks sharing memory; ordering by rank makes rank 0 of comm the leader of its node
+  MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node);
+  int node_rank = 0;
+  MPI_Comm_rank(node, &node_rank);
+  MPI_Comm_split(comm, node_rank == 0 ? 0 : MPI_UNDEFINED, rank, &leaders);
+
+  // the leader owns the whole segment, the other ranks attach to it
+  char *segment = nullptr;
+  MPI_Win_allocate_shared(node_rank == 0 ? bytes : 0, 1, MPI_INFO_NULL, node, &segment, &win);
+  if(node_rank != 0)
+    {
+      MPI_Aint segment_size = 0;
+      int disp_unit = 0;
+      MPI_Win_shared_query(win, 0, &segment_size, &disp_unit, &segment);
+    }
+
+  MPI_Win_fence(0, win);
+  if(node_rank == 0)
+    {
+      if(rank == 0)
+        std::memcpy(segment, buffer.data(), bytes);
+      broadcast_bytes(segment, bytes, 0, leaders);
+    }
+  MPI_Win_fence(0, win);
+  base = segment;
+}
+
+node_shared_scene::~node_shared_scene()
+{
+  if(win != MPI_WIN_NULL)
+    MPI_Win_free(&win);
+  if(leaders != MPI_COMM_NULL)
+    MPI_Comm_free(&leaders);
+  if(node != MPI_COMM_NULL)
+    MPI_Comm_free(&node);
+}
@@ -0,0 +1,45 @@
+#ifndef __H_MPI_SCENE__
+#define __H_MPI_SCENE__
+
+#include <mpi.h>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief send size bytes at data from root to every rank of comm. Large buffers
+ * go in pieces of at most 256 MB, which keeps every count within an int and lets
+ * the MPI library pipeline the pieces down its broadcast tree.
+ */
+void broadcast_bytes(char *data, uint64_t size, int root, MPI_Comm comm);
+
+/**
+ * @brief send buffer from root to every rank of comm, the other ranks resize it to fit
+ */
+void broadcast_buffer(std::vector<char> &buffer, int root, MPI_Comm comm);
+
+/**
+ * A flat scene (see flat_scene.h) held once per node in an MPI shared memory
+ * window. Rank 0 of comm provides the scene, it is broadcast to one rank per
+ * node, and every rank reads its node's copy in place.
+ */
+class node_shared_scene
+{
+public:
+  // collective over comm, only rank 0's buffer is read
+  node_shared_scene(const std::vector<char> &buffer, MPI_Comm comm);
+  ~node_shared_scene();
+  node_shared_scene(const node_shared_scene &) = delete;
+  node_shared_scene &operator=(const node_shared_scene &) = delete;
+
+  const char *data() const { return base; }
+  uint64_t size() const { return bytes; }
+
+private:
+  MPI_Comm node = MPI_COMM_NULL;
+  MPI_Comm leaders = MPI_COMM_NULL;
+  MPI_Win win = MPI_WIN_NULL;
+  const char *base = nullptr;
+  uint64_t bytes = 0;
+};
+
+#endif
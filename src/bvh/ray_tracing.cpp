@@ -2,6 +2,11 @@
 #include "common.h"
 #include <omp.h>
 #include "bvh.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <sstream>
+#include "render_budget.h"
 
 static color ray_color_hittable(const ray &r, const hittable &world, int depth)
 {
@@ -25,7 +30,7 @@ static color ray_color_hittable(const ray &r, const hittable &world, int depth)
     return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
 }
 
-static color ray_color(const ray &r, BVH &world, int depth)
+static color ray_color(const ray &r, BVH &world, int depth, first_hit *features = nullptr)
 {
     hit_record rec;
     Sphere *hitObject = nullptr;
@@ -35,6 +40,13 @@ static color ray_color(const ray &r, BVH &world, int depth)
 
     if (world.intersect(r, &hitObject, rec))
     {
+        if (features != nullptr)
+        {
+            features->albedo = rec.mat_ptr->surface_albedo();
+            features->normal = rec.normal;
+            features->depth = (rec.p - r.origin()).length();
+        }
+
         ray scattered;
         color attenuation;
         if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
@@ -50,7 +62,68 @@ static color ray_color(const ray &r, BVH &world, int depth)
     //otherwise return the background color
     vec3 unit_direction = unit_vector(r.direction());
     auto t = 0.5 * (unit_direction.y() + 1.0);
-    return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
+    color background = (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
+    if (features != nullptr)
+    {
+        features->albedo = background;
+        features->normal = vec3(0, 0, 0);
+        features->depth = kMissDepth;
+    }
+    return background;
+}
+
+color render_pixel(const traceConfig &config, BVH &world, int i, int j, int samples, aux_buffer *aux)
+{
+    const camera &cam = config.cam;
+    const int samples_per_pixel = samples;
+    color pixel_color(0, 0, 0);
+    if (aux == nullptr)
+    {
+        for (int s = 0; s < samples_per_pixel; ++s)
+        {
+            auto u = (i + random_double()) / (config.width - 1);
+            auto v = (j + random_double()) / (config.height - 1);
+
+            ray r = cam.get_ray(u, v);
+            pixel_color += ray_color(r, world, config.traceDepth);
+        }
+        return pixel_color;
+    }
+
+    first_hit pixel_features;
+    for (int s = 0; s < samples_per_pixel; ++s)
+    {
+        auto u = (i + random_double()) / (config.width - 1);
+        auto v = (j + random_double()) / (config.height - 1);
+
+        ray r = cam.get_ray(u, v);
+        first_hit features;
+        pixel_color += ray_color(r, world, config.traceDepth, &features);
+        pixel_features += features;
+    }
+    aux->store((config.height - 1 - j) * config.width + i, pixel_features, samples_per_pixel);
+    return pixel_color;
+}
+
+// optional post-render stage over out_image
+static void denoise_output(const traceConfig &config, color *out_image, const aux_buffer &aux)
+{
+    const denoiseConfig &denoise = config.denoise;
+    double noisy_error = -1;
+    if (!denoise.referenceFile.empty())
+        noisy_error = image_rmse(out_image, config.width, config.height, config.samplePerPixel, denoise.referenceFile);
+
+    double tstart = omp_get_wtime();
+    denoise_atrous(out_image, config.width, config.height, config.samplePerPixel, aux, denoise);
+    double tend = omp_get_wtime();
+    std::cerr << "Denoise time: " << tend - tstart << "\n";
+
+    if (noisy_error >= 0)
+    {
+        double denoised_error = image_rmse(out_image, config.width, config.height, config.samplePerPixel, denoise.referenceFile);
+        std::cerr << "RMSE against " << denoise.referenceFile << ": noisy " << noisy_error
+                  << ", denoised " << denoised_error << "\n";
+    }
 }
 
 void printDataSizes(const traceConfig &config)
@@ -100,28 +173,141 @@ void raytracing_bvh_single_threaded(const traceConfig &config, BVH &world)
 
 void raytracing_bvh(const traceConfig &config, BVH &world)
 {
-    const camera &cam = config.cam;
     const int image_width = config.width;
     const int image_height = config.height;
-    const int max_depth = config.traceDepth;
     const int samples_per_pixel = config.samplePerPixel;
     const int threadNumer = config.numProcs;
 
-    color *out_image = new color[image_width * image_height];
+    // rows are written while rendering unless the whole image is needed afterwards
+    unique_ptr<tile_writer> writer;
+    if (config.printOutput && !config.denoise.enabled && tile_writer::supports(config.output))
+        writer = make_unique<tile_writer>(config.output, image_width, image_height, samples_per_pixel, 4 * threadNumer + 16);
+
+    color *out_image = writer ? nullptr : new color[image_width * image_height];
+    unique_ptr<aux_buffer> aux;
+    if (config.denoise.enabled)
+        aux = make_unique<aux_buffer>(image_width, image_height);
 
     omp_set_num_threads(threadNumer);
     double tstart = omp_get_wtime();
-#pragma omp parallel shared(out_image, cam)
+#pragma omp parallel shared(out_image, aux, writer)
     {
+        std::vector<color> row(writer ? image_width : 0);
 #pragma omp for schedule(dynamic)
         for (int j = config.height - 1; j >= 0; j--)
         {
             // std::cerr << "\rScanlines remaining: " << j << ' ' << omp_get_thread_num() << std::endl;
-
+            color *dest = writer ? row.data() : out_image + (image_height - 1 - j) * image_width;
             for (int i = 0; i < config.width; i++)
+            {
+                dest[i] = render_pixel(config, world, i, j, config.samplePerPixel, aux.get());
+            }
+            if (writer)
+                writer->submit_row(image_height - 1 - j, dest);
+        }
+    }
+
+    if (writer)
+        writer->finish();
+    double tend = omp_get_wtime();
+    if (aux)
+        denoise_output(config, out_image, *aux);
+
+    if (config.printOutput)
+    {
+        if (!writer)
+            write_image(config.output, out_image, image_width, image_height, samples_per_pixel);
+        std::cerr << "\n\nElapsed time: " << tend - tstart << "\n";
+        std::cerr << "\nDone.\n";
+    }
+    delete[] out_image;
+}
+
+bool progressive_options(const options &opts, progressiveConfig &progressive)
+{
+    progressive.samplesPerPass = std::max(1, opts.get_int("pass-samples", progressive.samplesPerPass));
+    progressive.passesPerCheckpoint = std::max(1, opts.get_int("checkpoint-every", progressive.passesPerCheckpoint));
+    progressive.checkpointFile = opts.get("checkpoint", "");
+    progressive.resume = opts.has("resume");
+    progressive.seed = static_cast<uint64_t>(opts.get_int("seed", 0));
+    progressive.deadline = std::max(0.0, opts.get_double("deadline", 0));
+    if (progressive.deadline > 0 && !progressive.checkpointFile.empty())
+    {
+        std::cerr << "--deadline cannot be combined with --checkpoint" << std::endl;
+        exit(1);
+    }
+    return opts.has("progressive") || !progressive.checkpointFile.empty() || progressive.deadline > 0;
+}
+
+render_checkpoint begin_progressive(const traceConfig &config, const progressiveConfig &progressive)
+{
+    render_checkpoint state;
+    if (progressive.resume && !progressive.checkpointFile.empty() && load_checkpoint(progressive.checkpointFile, state))
+    {
+        if (state.image.width == config.width && state.image.height == config.height && state.samples_per_pass == progressive.samplesPerPass)
+        {
+            std::cerr << "Resuming from " << progressive.checkpointFile << " after " << state.passes_done << " passes\n";
+            return state;
+        }
+        std::cerr << "Checkpoint " << progressive.checkpointFile << " does not match this render, starting over\n";
+    }
+
+    state = render_checkpoint();
+    state.seed = progressive.seed;
+    state.samples_per_pass = progressive.samplesPerPass;
+    state.image = framebuffer(config.width, config.height);
+    return state;
+}
+
+void checkpoint_progressive(const progressiveConfig &progressive, const render_checkpoint &state, int totalPasses)
+{
+    if (progressive.checkpointFile.empty())
+        return;
+    if (state.passes_done % progressive.passesPerCheckpoint == 0 || state.passes_done >= totalPasses || stop_requested())
+        save_checkpoint(progressive.checkpointFile, state);
+}
+
+void raytracing_bvh_progressive(const traceConfig &config, BVH &world, const progressiveConfig &progressive)
+{
+    const camera &cam = config.cam;
+    const int image_width = config.width;
+    const int image_height = config.height;
+    const int max_depth = config.traceDepth;
+    const int samples_per_pixel = config.samplePerPixel;
+    const int threadNumer = config.numProcs;
+
+    render_checkpoint state = begin_progressive(config, progressive);
+    const int samples_per_pass = state.samples_per_pass;
+    const int total_passes = (samples_per_pixel + samples_per_pass - 1) / samples_per_pass;
+    const double frame_pixels = static_cast<double>(image_width) * image_height;
+    int samples_done = state.passes_done * samples_per_pass;
+
+    // with a deadline the first pass of one sample measures the cost of a sample,
+    // later passes are sized to what is left, as in the mpi renderer
+    render_budget budget(progressive.deadline);
+    if (progressive.deadline > 0)
+        budget.reserve_output(config.output, image_width, image_height);
+
+    omp_set_num_threads(threadNumer);
+    double tstart = omp_get_wtime();
+    while (samples_done < samples_per_pixel && !stop_requested())
+    {
+        const int pass = state.passes_done;
+        int pass_samples = std::min(samples_per_pass, samples_per_pixel - samples_done);
+        if (progressive.deadline > 0)
+            pass_samples = pass == 0 ? 1 : budget.samples_that_fit(frame_pixels, pass_samples);
+        if (pass_samples <= 0)
+            break;
+
+        double pass_start = omp_get_wtime();
+#pragma omp parallel for schedule(dynamic) shared(state, cam)
+        for (int j = image_height - 1; j >= 0; j--)
+        {
+            reseed_generator(mix_seed(mix_seed(state.seed, pass), j));
+            for (int i = 0; i < image_width; i++)
             {
                 color pixel_color(0, 0, 0);
-                for (int s = 0; s < samples_per_pixel; ++s)
+                for (int s = 0; s < pass_samples; ++s)
                 {
                     auto u = (i + random_double()) / (image_width - 1);
                     auto v = (j + random_double()) / (image_height - 1);
@@ -129,23 +315,32 @@ void raytracing_bvh(const traceConfig &config, BVH &world)
                     ray r = cam.get_ray(u, v);
                     pixel_color += ray_color(r, world, max_depth);
                 }
-                out_image[((image_height - 1 - j) * image_width + i)] = pixel_color;
+                state.image.add((image_height - 1 - j) * image_width + i, pixel_color, pass_samples);
             }
         }
+        budget.record(omp_get_wtime() - pass_start, frame_pixels * pass_samples);
+
+        state.passes_done++;
+        samples_done += pass_samples;
+        checkpoint_progressive(progressive, state, total_passes);
+        if (progressive.deadline > 0)
+            std::cerr << "\rPass " << state.passes_done << ", " << samples_done << " samples, " << budget.remaining() << " s left" << std::flush;
+        else
+            std::cerr << "\rPass " << state.passes_done << "/" << total_passes << std::flush;
     }
 
     double tend = omp_get_wtime();
 
     if (config.printOutput)
     {
-        std ::cout << "P3\n"
-                   << image_width << ' ' << image_height << "\n255\n";
-        for (int i = 0; i < image_height * image_width; i++)
-            write_color(std::cout, out_image[i], samples_per_pixel);
+        write_image(config.output, state.image);
+        if (samples_done < samples_per_pixel)
+            std::cerr << "\nStopped after " << state.passes_done << " passes, " << samples_done << " of " << samples_per_pixel << " samples";
+        if (progressive.deadline > 0)
+            std::cerr << "\nSPP_ACHIEVED: " << samples_summary(state.image);
         std::cerr << "\n\nElapsed time: " << tend - tstart << "\n";
         std::cerr << "\nDone.\n";
     }
-    delete[] out_image;
 }
 
 void raytracing_hittablelist(const traceConfig &config, hittable_list &world)
@@ -178,6 +373,28 @@ void raytracing_hittablelist(const traceConfig &config, hittable_list &world)
     }
 }
 
+std::vector<int> balancedPartition(const std::vector<double> &cost, int parts)
+{
+    std::vector<double> prefix(cost.size() + 1, 0.0);
+    for (size_t i = 0; i < cost.size(); i++)
+        prefix[i + 1] = prefix[i] + std::max(cost[i], 0.0);
+
+    std::vector<int> bounds(parts + 1, 0);
+    bounds[parts] = static_cast<int>(cost.size());
+    for (int p = 1; p < parts; p++)
+    {
+        // the first item whose cost crosses the p-th share
+        const double target = prefix.back() * p / parts;
+        auto it = std::lower_bound(prefix.begin() + bounds[p - 1], prefix.end(), target);
+        int k = std::min(static_cast<int>(it - prefix.begin()), bounds[parts]);
+        // or the item before it, if that ends closer to the share
+        if (k > bounds[p - 1] && target - prefix[k - 1] < prefix[k] - target)
+            k--;
+        bounds[p] = k;
+    }
+    return bounds;
+}
+
 bool getTileIndexes(const int width, const int height, const int tileSize, const int id, int &startRow, int &startCol, int &endRow, int &endCol)
 {
     const int excess_cols = width % tileSize;
@@ -205,57 +422,267 @@ bool getTileIndexes(const int width, const int height, const int tileSize, const
 
 void raytracing_bvh_tiled(const traceConfig &config, BVH &world, const int tileSize)
 {
-    const camera &cam = config.cam;
     const int image_width = config.width;
     const int image_height = config.height;
-    const int max_depth = config.traceDepth;
     const int samples_per_pixel = config.samplePerPixel;
     const int threadNumer = config.numProcs;
 
-    color *out_image = new color[image_width * image_height];
+    // tiles are written while rendering unless the whole image is needed afterwards
+    unique_ptr<tile_writer> writer;
+    if (config.printOutput && !config.denoise.enabled && tile_writer::supports(config.output))
+        writer = make_unique<tile_writer>(config.output, image_width, image_height, samples_per_pixel, tileSize * (threadNumer + 1));
+
+    color *out_image = writer ? nullptr : new color[image_width * image_height];
+    unique_ptr<aux_buffer> aux;
+    if (config.denoise.enabled)
+        aux = make_unique<aux_buffer>(image_width, image_height);
 
     omp_set_num_threads(threadNumer);
 
     double tstart = omp_get_wtime();
-#pragma omp parallel shared(out_image, cam)
+#pragma omp parallel shared(out_image, aux, writer)
     {
         int threadId = omp_get_thread_num();
         int numThreads = omp_get_num_threads();
         int startRow, startCol, endRow, endCol;
+        std::vector<color> tile(writer ? tileSize * tileSize : 0);
 
+        // tile rows count from the top of the image so tiles finish in output order
         int tileId = threadId; // initial value to be threadId
         while (getTileIndexes(image_width, image_height, tileSize, tileId, startRow, startCol, endRow, endCol))
         {
-            for (int j = startRow; j < endRow; j++)
+            const int stride = writer ? endCol - startCol : image_width;
+            color *dest = writer ? tile.data() : out_image + startRow * image_width + startCol;
+            for (int y = startRow; y < endRow; y++)
             {
                 for (int i = startCol; i < endCol; i++)
                 {
-                    color pixel_color(0, 0, 0);
-                    for (int s = 0; s < samples_per_pixel; ++s)
-                    {
-                        auto u = (i + random_double()) / (image_width - 1);
-                        auto v = (j + random_double()) / (image_height - 1);
-
-                        ray r = cam.get_ray(u, v);
-                        pixel_color += ray_color(r, world, max_depth);
-                    }
-                    out_image[((image_height-1-j) * image_width + i)] = pixel_color;
+                    dest[(y - startRow) * stride + i - startCol] = render_pixel(config, world, i, image_height - 1 - y, config.samplePerPixel, aux.get());
                 }
             }
+            if (writer)
+                writer->submit_tile(startCol, startRow, endCol - startCol, endRow - startRow, dest, stride);
             tileId+=numThreads;
         }
     }
 
+    if (writer)
+        writer->finish();
     double tend = omp_get_wtime();
+    if (aux)
+        denoise_output(config, out_image, *aux);
 
     if (config.printOutput)
     {
-        std ::cout << "P3\n"
-                   << image_width << ' ' << image_height << "\n255\n";
-        for (int i = 0; i < image_height * image_width; i++)
-            write_color(std::cout, out_image[i], samples_per_pixel);
+        if (!writer)
+            write_image(config.output, out_image, image_width, image_height, samples_per_pixel);
         std::cerr << "\n\nElapsed time: " << tend - tstart << "\n";
         std::cerr << "\nDone.\n";
     }
     delete[] out_image;
 }
+
+void raytracing_bvh_region(const traceConfig &config, BVH &world, int x0, int y0, int w, int h, color *sums)
+{
+    const uint64_t frameStream = mix_seed(config.seed, config.pass);
+
+#pragma omp parallel for schedule(dynamic) num_threads(config.numProcs)
+    for (int y = y0; y < y0 + h; y++)
+    {
+        const int j = config.height - 1 - y;
+        // the streams of the mpi renderer's spans, full width rows match its row split
+        const uint64_t rowStream = mix_seed(frameStream, j);
+        reseed_generator(x0 == 0 ? rowStream : mix_seed(rowStream, x0));
+        color *dest = sums + static_cast<size_t>(y - y0) * w;
+        for (int i = x0; i < x0 + w; i++)
+            dest[i - x0] = render_pixel(config, world, i, j, config.samplePerPixel);
+    }
+}
+
+void raytracing_bvh_tiled_deadline(const traceConfig &config, BVH &world, const int tileSize, const progressiveConfig &progressive)
+{
+    const int image_width = config.width;
+    const int image_height = config.height;
+    const int threadNumer = config.numProcs;
+
+    render_budget budget(progressive.deadline);
+    budget.reserve_output(config.output, image_width, image_height);
+    framebuffer image(image_width, image_height);
+
+    int numTiles = 0;
+    {
+        int startRow, startCol, endRow, endCol;
+        while (getTileIndexes(image_width, image_height, tileSize, numTiles, startRow, startCol, endRow, endCol))
+            numTiles++;
+    }
+
+    omp_set_num_threads(threadNumer);
+    double tstart = omp_get_wtime();
+    int samplesDone = 0;
+    std::atomic<bool> outOfTime(false);
+    while (samplesDone < config.samplePerPixel && !outOfTime)
+    {
+        const int pass = samplesDone / std::max(1, progressive.samplesPerPass);
+        traceConfig passConfig = config;
+        passConfig.samplePerPixel = std::min(progressive.samplesPerPass, config.samplePerPixel - samplesDone);
+        std::atomic<int> nextTile(0);
+
+#pragma omp parallel shared(image, budget)
+        {
+            int tileId;
+            while (!outOfTime && (tileId = nextTile++) < numTiles)
+            {
+                int startRow, startCol, endRow, endCol;
+                if (!getTileIndexes(image_width, image_height, tileSize, tileId, startRow, startCol, endRow, endCol))
+                    break;
+                const double tileSamples = static_cast<double>(endRow - startRow) * (endCol - startCol) * passConfig.samplePerPixel;
+                if (!budget.fits(tileSamples))
+                {
+                    outOfTime = true;
+                    break;
+                }
+                double tileStart = omp_get_wtime();
+                for (int y = startRow; y < endRow; y++)
+                {
+                    const int j = image_height - 1 - y;
+                    reseed_generator(mix_seed(mix_seed(mix_seed(progressive.seed, pass), j), startCol));
+                    for (int i = startCol; i < endCol; i++)
+                        image.add(y * image_width + i, render_pixel(passConfig, world, i, j, passConfig.samplePerPixel), passConfig.samplePerPixel);
+                }
+                budget.record(omp_get_wtime() - tileStart, tileSamples);
+            }
+        }
+        samplesDone += passConfig.samplePerPixel;
+        std::cerr << "\rPass " << pass + 1 << ", " << budget.remaining() << " s left" << std::flush;
+    }
+    double tend = omp_get_wtime();
+
+    if (config.printOutput)
+        write_image(config.output, image);
+    std::cerr << "\nSPP_ACHIEVED: " << samples_summary(image) << "\n";
+    std::cerr << "\nElapsed time: " << tend - tstart << ", " << omp_get_wtime() - tstart << " with the output\n";
+}
+
+bool crop_options(const options &opts, int width, int height, std::vector<cropRect> &rects)
+{
+    rects.clear();
+    std::stringstream crops(opts.get("crop", ""));
+    std::string item;
+    while (std::getline(crops, item, '+'))
+    {
+        cropRect r;
+        if (std::sscanf(item.c_str(), "%d,%d,%d,%d", &r.x0, &r.y0, &r.w, &r.h) != 4)
+        {
+            std::cerr << "Expected --crop=x0,y0,w,h[+x0,y0,w,h...], got " << item << std::endl;
+            exit(1);
+        }
+        rects.push_back(r);
+    }
+
+    const std::string tiles = opts.get("crop-tiles", "");
+    if (!tiles.empty())
+    {
+        int tileSize = 0;
+        auto colon = tiles.find(':');
+        if (colon != std::string::npos)
+            tileSize = std::atoi(tiles.substr(0, colon).c_str());
+        if (tileSize < 1)
+        {
+            std::cerr << "Expected --crop-tiles=size:id[,id...], got " << tiles << std::endl;
+            exit(1);
+        }
+        std::stringstream ids(tiles.substr(colon + 1));
+        while (std::getline(ids, item, ','))
+        {
+            int startRow, startCol, endRow, endCol;
+            if (!getTileIndexes(width, height, tileSize, std::atoi(item.c_str()), startRow, startCol, endRow, endCol))
+            {
+                std::cerr << "Tile " << item << " of size " << tileSize << " is outside the frame" << std::endl;
+                exit(1);
+            }
+            rects.push_back(cropRect{startCol, startRow, endCol - startCol, endRow - startRow});
+        }
+    }
+
+    for (const cropRect &r : rects)
+    {
+        if (r.x0 < 0 || r.y0 < 0 || r.w < 1 || r.h < 1 || r.x0 + r.w > width || r.y0 + r.h > height)
+        {
+            std::cerr << "Crop " << r.x0 << "," << r.y0 << "," << r.w << "," << r.h << " is not inside the "
+                      << width << "x" << height << " frame" << std::endl;
+            exit(1);
+        }
+    }
+    return !rects.empty();
+}
+
+void raytracing_bvh_crop(const traceConfig &config, BVH &world, const std::vector<cropRect> &rects, const std::string &patchFile)
+{
+    const int image_width = config.width;
+    const int image_height = config.height;
+    const int samples_per_pixel = config.samplePerPixel;
+
+    // the frame, or the bounding box of the rectangles, as per-pixel means
+    int left = image_width, top = image_height, right = 0, bottom = 0;
+    for (const cropRect &r : rects)
+    {
+        left = std::min(left, r.x0);
+        top = std::min(top, r.y0);
+        right = std::max(right, r.x0 + r.w);
+        bottom = std::max(bottom, r.y0 + r.h);
+    }
+    if (!patchFile.empty())
+    {
+        left = 0;
+        top = 0;
+        right = image_width;
+        bottom = image_height;
+    }
+    const int out_width = right - left;
+    const int out_height = bottom - top;
+    std::vector<color> out_image(static_cast<size_t>(out_width) * out_height, color(0, 0, 0));
+
+    if (!patchFile.empty())
+    {
+        int width = 0, height = 0;
+        std::vector<unsigned char> rgb;
+        if (!read_ppm(patchFile, width, height, rgb))
+        {
+            std::cerr << "Cannot read the frame " << patchFile << std::endl;
+            exit(1);
+        }
+        if (width != image_width || height != image_height)
+        {
+            std::cerr << "Frame " << patchFile << " is " << width << "x" << height << ", not "
+                      << image_width << "x" << image_height << std::endl;
+            exit(1);
+        }
+        // the means to_8bit maps back onto the same values
+        for (size_t k = 0; k < out_image.size(); k++)
+        {
+            double c[3];
+            for (int a = 0; a < 3; a++)
+            {
+                double level = (rgb[3 * k + a] + 0.5) / 256;
+                c[a] = level * level;
+            }
+            out_image[k] = color(c[0], c[1], c[2]);
+        }
+    }
+
+    double tstart = omp_get_wtime();
+    std::vector<color> sums;
+    for (const cropRect &r : rects)
+    {
+        sums.resize(static_cast<size_t>(r.w) * r.h);
+        raytracing_bvh_region(config, world, r.x0, r.y0, r.w, r.h, sums.data());
+        for (int y = 0; y < r.h; y++)
+            for (int x = 0; x < r.w; x++)
+                out_image[static_cast<size_t>(r.y0 + y - top) * out_width + r.x0 + x - left] =
+                    sums[static_cast<size_t>(y) * r.w + x] / samples_per_pixel;
+    }
+    double tend = omp_get_wtime();
+
+    write_image(config.output, out_image.data(), out_width, out_height, 1);
+    std::cerr << "\n\nElapsed time: " << tend - tstart << "\n";
+}
@@ -6,6 +6,14 @@
 #include "color.h"
 #include "hittable_list.h"
 #include "hittable.h"
+#include "checkpoint.h"
+#include "denoise.h"
+#include "image_io.h"
+#include "tile_writer.h"
+#include "wire_format.h"
+#include "options.h"
+#include <string>
+#include <vector>
 
 struct traceConfig
 {
@@ -18,10 +26,26 @@ struct traceConfig
     int numProcs;
     int myRank;
     int threadsPerProc;
+    // random stream of the sample pass being rendered, see checkpoint.h
+    uint64_t seed = 0;
+    int pass = 0;
+    // optional post-render denoising, used by raytracing_bvh and raytracing_bvh_tiled
+    denoiseConfig denoise;
+    // image format and destination used when printOutput is set
+    image_output output;
+    // pixel encoding between MPI ranks
+    wire_format wire = wire_format::float32;
     traceConfig(camera &_cam, int _width, int _height, int _depth, int _sample, int _numProcs, int _myRank, int _threads_per_proc): traceConfig(_cam, _width, _height, _depth, _sample, _numProcs, _myRank, _threads_per_proc, false){}
     traceConfig(camera &_cam, int _width, int _height, int _depth, int _sample, int _numProcs, int _myRank, int _threads_per_proc, bool _print_output)    :cam(_cam), width(_width), height(_height), traceDepth(_depth), samplePerPixel(_sample), numProcs(_numProcs), myRank(_myRank), threadsPerProc(_threads_per_proc), printOutput(_print_output){}
 };
 
+/**
+ * @brief the sum of `samples` samples of pixel (i, j), j counted from the bottom row,
+ * drawn from the calling thread's generator. With aux the averaged first-hit features
+ * are recorded too. Every renderer traces its pixels through this.
+ */
+color render_pixel(const traceConfig &config, BVH &world, int i, int j, int samples, aux_buffer *aux = nullptr);
+
 /**
  * @brief openmp version of bvh tracing
  */
@@ -35,9 +59,92 @@ void raytracing_bvh_single_threaded(const traceConfig &config, BVH &world);
 
 void raytracing_bvh_mpi(const traceConfig &config, BVH &world);
 
+struct progressiveConfig
+{
+    int samplesPerPass = 10;
+    int passesPerCheckpoint = 1;
+    std::string checkpointFile; // no checkpoints are written when empty
+    bool resume = false;
+    uint64_t seed = 0;
+    double deadline = 0; // wall clock seconds for the whole render including the output, 0 for none
+};
+
+/**
+ * @brief read --progressive, --pass-samples, --checkpoint, --checkpoint-every,
+ * --resume, --seed and --deadline. Returns true if progressive rendering was
+ * requested, which a deadline implies. Exits if a deadline is combined with
+ * checkpoints.
+ */
+bool progressive_options(const options &opts, progressiveConfig &progressive);
+
+/**
+ * @brief start a progressive render: the state stored in the checkpoint file if
+ * resuming and the checkpoint matches the configuration, a blank one otherwise.
+ */
+render_checkpoint begin_progressive(const traceConfig &config, const progressiveConfig &progressive);
+
+/**
+ * @brief write a checkpoint if one is due after the pass that was just completed
+ */
+void checkpoint_progressive(const progressiveConfig &progressive, const render_checkpoint &state, int totalPasses);
+
+/**
+ * @brief openmp bvh tracing that accumulates config.samplePerPixel samples in
+ * passes of progressive.samplesPerPass, checkpointing between passes. Stops early
+ * with the image accumulated so far when stop_requested() becomes true. With
+ * progressive.deadline every pass is sized to end before the image has to be
+ * written, and the samples per pixel reached are printed.
+ */
+void raytracing_bvh_progressive(const traceConfig &config, BVH &world, const progressiveConfig &progressive);
+
+/**
+ * @brief openmp bvh tracing of the pixels (x0..x0+w, y0..y0+h) of the frame, row 0
+ * at the top, into w * h per-pixel sums, without any output. Each row of the region
+ * draws from its own random stream, so the result does not depend on the threads
+ * or on the rows around the region.
+ */
+void raytracing_bvh_region(const traceConfig &config, BVH &world, int x0, int y0, int w, int h, color *sums);
+
+// A rectangle of the frame, x0 and y0 from the top left corner.
+struct cropRect
+{
+    int x0, y0, w, h;
+};
+
+/**
+ * @brief read --crop=x0,y0,w,h[+x0,y0,w,h...] and --crop-tiles=size:id[,id...], the
+ * tiles numbered as by getTileIndexes. Returns true if either was given, exits if a
+ * rectangle does not lie inside the width x height frame.
+ */
+bool crop_options(const options &opts, int width, int height, std::vector<cropRect> &rects);
+
+/**
+ * @brief openmp bvh tracing of the given rectangles of the frame only, with the
+ * camera rays of the full frame. Without patchFile the bounding box of the
+ * rectangles is written as a sub-image, black outside them. With it, the P3 or
+ * P6 frame in patchFile is read, the rectangles are replaced and the whole frame
+ * is written to config.output.
+ */
+void raytracing_bvh_crop(const traceConfig &config, BVH &world, const std::vector<cropRect> &rects, const std::string &patchFile);
+
 void raytracing_hittablelist(const traceConfig &config, hittable_list &world);
 
+/**
+ * @brief split items 0..cost.size() into `parts` contiguous ranges of about equal
+ * summed cost. Returns parts + 1 boundaries, range p being [b[p], b[p + 1]).
+ */
+std::vector<int> balancedPartition(const std::vector<double> &cost, int parts);
+
 bool getTileIndexes(const int width, const int height, const int tileSize, const int id, int &startRow, int &startCol, int &endRow, int &endCol);
 void raytracing_bvh_tiled(const traceConfig &config, BVH &world, const int tileSize);
 
+/**
+ * @brief openmp tiled bvh tracing within progressive.deadline seconds. Passes of
+ * progressive.samplesPerPass samples go over all tiles, up to config.samplePerPixel;
+ * a thread takes its next tile only while the tile is expected to be done before
+ * the image has to be written, so the last pass may cover only some tiles. Prints
+ * the samples per pixel reached.
+ */
+void raytracing_bvh_tiled_deadline(const traceConfig &config, BVH &world, const int tileSize, const progressiveConfig &progressive);
+
 #endif
\ No newline at end of file
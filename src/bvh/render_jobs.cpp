@@ -0,0 +1,300 @@
+#include "render_jobs.h"
+#include "ray_tracing.h"
+#include "data_porting.h"
+#include "sphere_generation.h"
+#include "vec3.h"
+#include "camera.h"
+#include "color.h"
+#include "image_io.h"
+#include "options.h"
+#include <omp.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+
+// FNV-1a, continued from h
+static uint64_t hash_bytes(uint64_t h, const char *data, size_t size)
+{
+  for(size_t i = 0; i < size; i++)
+    {
+      h ^= static_cast<unsigned char>(data[i]);
+      h *= 0x100000001b3ULL;
+    }
+  return h;
+}
+
+static const uint64_t hash_start = 0xcbf29ce484222325ULL;
+
+cached_scene::~cached_scene()
+{
+  world.reset();
+  ShapeDataIO().clear_scene(spheres);
+}
+
+cached_scene *scene_cache::get(const std::string &file, bool &cached, std::string &error)
+{
+  uint64_t hash = 0;
+  if(!scene_hash(file, hash, error))
+    return nullptr;
+  for(auto it = scenes.begin(); it != scenes.end(); ++it)
+    if((*it)->hash == hash)
+      {
+        scenes.splice(scenes.begin(), scenes, it);
+        cached = true;
+        return scenes.front().get();
+      }
+
+  cached = false;
+  std::unique_ptr<cached_scene> scene(new cached_scene());
+  scene->hash = hash;
+  // a malformed scene fails this job only, the service keeps running
+  if(!ShapeDataIO().load_scene(file, scene->spheres, error))
+    return nullptr;
+  if(scene->spheres.empty())
+    {
+      error = "scene " + file + " has no spheres";
+      return nullptr;
+    }
+  scene->world.reset(new BVH(scene->spheres));
+  scenes.push_front(std::move(scene));
+  while(scenes.size() > capacity)
+    scenes.pop_back();
+  return scenes.front().get();
+}
+
+bool scene_cache::scene_hash(const std::string &file, uint64_t &hash, std::string &error)
+{
+  if(SphereGeneration::is_spec(file))
+    {
+      SceneGenerationParams params;
+      if(!SphereGeneration::parse_spec(file, params))
+        {
+          error = "invalid scene spec " + file;
+          return false;
+        }
+      hash = hash_bytes(hash_start, file.data(), file.size());
+      return true;
+    }
+
+  struct stat status;
+  if(stat(file.c_str(), &status) != 0 || !S_ISREG(status.st_mode))
+    {
+      error = "cannot read scene " + file;
+      return false;
+    }
+  auto known = stamps.find(file);
+  if(known != stamps.end() && known->second.mtime == status.st_mtime && known->second.size == status.st_size)
+    {
+      hash = known->second.hash;
+      return true;
+    }
+
+  std::ifstream in(file, std::ios::binary);
+  std::vector<char> chunk(1 << 20);
+  hash = hash_start;
+  while(in.read(chunk.data(), chunk.size()) || in.gcount() > 0)
+    hash = hash_bytes(hash, chunk.data(), in.gcount());
+  stamps[file] = file_stamp{status.st_mtime, status.st_size, hash};
+  return true;
+}
+
+// One render request, a line of --name=value options.
+struct render_job
+{
+  std::string scene;
+  int width = 400;
+  int height = 0; // from the aspect ratio when 0
+  int spp = 10;
+  int depth = 50;
+  point3 lookfrom = point3(13, 2, 3);
+  point3 lookat = point3(0, 0, 0);
+  double vfov = 20;
+  double aperture = 0.1;
+  double focus = 10;
+  int region[4] = {0, 0, 0, 0}; // x0, y0, w, h of the pixels rendered, the whole frame when w is 0
+  uint64_t seed = 0;
+  image_output output;
+  bool to_file = false;
+};
+
+static bool parse_vec3(const std::string &text, point3 &v)
+{
+  return std::sscanf(text.c_str(), "%lf,%lf,%lf", &v.e[0], &v.e[1], &v.e[2]) == 3;
+}
+
+static bool parse_job(const std::string &line, render_job &job, std::string &error)
+{
+  std::istringstream words(line);
+  std::vector<std::string> tokens{"job"};
+  std::string word;
+  while(words >> word)
+    tokens.push_back(word);
+  std::vector<char *> argv;
+  for(auto &t : tokens)
+    argv.push_back(&t[0]);
+  options opts(static_cast<int>(argv.size()), argv.data());
+
+  job.scene = opts.get("scene", "");
+  if(job.scene.empty())
+    {
+      error = "missing --scene";
+      return false;
+    }
+  job.width = opts.get_int("width", job.width);
+  job.height = opts.get_int("height", static_cast<int>(job.width / 1.5));
+  job.spp = opts.get_int("spp", job.spp);
+  job.depth = opts.get_int("depth", job.depth);
+  job.vfov = opts.get_double("vfov", job.vfov);
+  job.aperture = opts.get_double("aperture", job.aperture);
+  job.focus = opts.get_double("focus", job.focus);
+  job.seed = std::strtoull(opts.get("seed", "0").c_str(), nullptr, 10);
+  if(job.width < 2 || job.height < 2 || job.spp < 1)
+    {
+      error = "width and height must be at least 2, spp at least 1";
+      return false;
+    }
+  if((opts.has("lookfrom") && !parse_vec3(opts.get("lookfrom", ""), job.lookfrom))
+     || (opts.has("lookat") && !parse_vec3(opts.get("lookat", ""), job.lookat)))
+    {
+      error = "expected --lookfrom=x,y,z and --lookat=x,y,z";
+      return false;
+    }
+
+  int *r = job.region;
+  if(opts.has("region"))
+    {
+      if(std::sscanf(opts.get("region", "").c_str(), "%d,%d,%d,%d", &r[0], &r[1], &r[2], &r[3]) != 4 || r[0] < 0
+         || r[1] < 0 || r[2] < 1 || r[3] < 1 || r[0] + r[2] > job.width || r[1] + r[3] > job.height)
+        {
+          error = "expected --region=x0,y0,w,h inside the image";
+          return false;
+        }
+    }
+  else
+    {
+      r[2] = job.width;
+      r[3] = job.height;
+    }
+
+  job.output.path = opts.get("output", "");
+  job.to_file = !job.output.path.empty() && job.output.path != "-";
+  std::string format = opts.get("format", "");
+  if(format.empty())
+    {
+      auto dot = job.output.path.rfind('.');
+      if(dot != std::string::npos)
+        parse_image_format(job.output.path.substr(dot + 1), job.output.format);
+    }
+  else if(!parse_image_format(format, job.output.format))
+    {
+      error = "unknown image format " + format;
+      return false;
+    }
+  return true;
+}
+
+bool job_stream::read_line(std::string &line)
+{
+  while(true)
+    {
+      auto end = buffer.find('\n');
+      if(end != std::string::npos)
+        {
+          line = buffer.substr(0, end);
+          buffer.erase(0, end + 1);
+          return true;
+        }
+      char chunk[4096];
+      ssize_t n = read(in, chunk, sizeof(chunk));
+      if(n <= 0)
+        {
+          // a last line without a newline
+          line.swap(buffer);
+          buffer.clear();
+          return !line.empty();
+        }
+      buffer.append(chunk, n);
+    }
+}
+
+bool job_stream::write_all(const void *data, size_t size)
+{
+  const char *p = static_cast<const char *>(data);
+  while(size > 0)
+    {
+      ssize_t n = write(out, p, size);
+      if(n <= 0)
+        return false;
+      p += n;
+      size -= n;
+    }
+  return true;
+}
+
+std::string run_job(const std::string &line, scene_cache &cache, int num_threads, std::vector<unsigned char> &image)
+{
+  image.clear();
+  render_job job;
+  std::string error;
+  if(!parse_job(line, job, error))
+    return "ERROR " + error + "\n";
+
+  double tstart = omp_get_wtime();
+  bool cached = false;
+  try
+    {
+      cached_scene *scene = cache.get(job.scene, cached, error);
+      if(scene == nullptr)
+        return "ERROR " + error + "\n";
+
+      camera cam(job.lookfrom, job.lookat, vec3(0, 1, 0), job.vfov, static_cast<double>(job.width) / job.height,
+                 job.aperture, job.focus);
+      traceConfig config(cam, job.width, job.height, job.depth, job.spp, num_threads, 0, 1);
+      config.seed = job.seed;
+      const int *r = job.region;
+      std::vector<color> sums(static_cast<size_t>(r[2]) * r[3]);
+      raytracing_bvh_region(config, *scene->world, r[0], r[1], r[2], r[3], sums.data());
+      image = encode_image(job.output.format, sums.data(), r[2], r[3], job.spp);
+    }
+  catch(const std::bad_alloc &)
+    {
+      // a scene or image too large for this machine fails its job only
+      image.clear();
+      return "ERROR out of memory\n";
+    }
+  double elapsed = omp_get_wtime() - tstart;
+
+  if(job.to_file)
+    {
+      if(!write_bytes(job.output, image))
+        return "ERROR cannot write " + job.output.path + "\n";
+      image.clear();
+    }
+  char reply[128];
+  std::snprintf(reply, sizeof(reply), "OK %zu %.3f %s\n", image.size(), elapsed * 1e3, cached ? "cached" : "loaded");
+  return reply;
+}
+
+bool serve(job_stream &stream, scene_cache &cache, int num_threads)
+{
+  std::string line;
+  std::vector<unsigned char> image;
+  while(stream.read_line(line))
+    {
+      auto first = line.find_first_not_of(" \t\r");
+      if(first == std::string::npos || line[first] == '#')
+        continue;
+      if(line.compare(first, 4, "quit") == 0)
+        return false;
+      std::string reply = run_job(line, cache, num_threads, image);
+      std::cerr << reply;
+      if(!stream.write_all(reply) || (!image.empty() && !stream.write_all(image.data(), image.size())))
+        return true;
+    }
+  return true;
+}
+
@@ -0,0 +1,79 @@
+#ifndef __H_RENDER_JOBS__
+#define __H_RENDER_JOBS__
+
+#include <algorithm>
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+#include "boundable.h"
+#include "bvh.hpp"
+
+// A loaded scene and its octree, kept between jobs.
+struct cached_scene
+{
+  uint64_t hash = 0;
+  std::vector<Sphere *> spheres;
+  std::unique_ptr<BVH> world;
+
+  ~cached_scene();
+};
+
+// Scenes by the hash of their contents, the least recently used dropped first
+// once more than `capacity` are held.
+class scene_cache
+{
+public:
+  explicit scene_cache(size_t capacity) : capacity(std::max<size_t>(1, capacity)) {}
+
+  // the scene of `file`, loaded and built unless cached; nullptr with `error` set if it
+  // cannot be read or is malformed
+  cached_scene *get(const std::string &file, bool &cached, std::string &error);
+
+  size_t size() const { return scenes.size(); }
+
+private:
+  // files are hashed again only when their size or modification time changed
+  struct file_stamp
+  {
+    time_t mtime;
+    off_t size;
+    uint64_t hash;
+  };
+
+  bool scene_hash(const std::string &file, uint64_t &hash, std::string &error);
+
+  const size_t capacity;
+  std::map<std::string, file_stamp> stamps;
+  std::list<std::unique_ptr<cached_scene>> scenes; // most recently used first
+};
+
+// Job lines in, replies out, over standard input and output or a socket.
+class job_stream
+{
+public:
+  job_stream(int in, int out) : in(in), out(out) {}
+
+  bool read_line(std::string &line);
+  bool write_all(const void *data, size_t size);
+  bool write_all(const std::string &text) { return write_all(text.data(), text.size()); }
+
+private:
+  int in;
+  int out;
+  std::string buffer;
+};
+
+// Renders one job line. The reply is `OK bytes milliseconds cached|loaded` followed
+// by `bytes` of image, none when the job wrote its own output file, or `ERROR message`.
+// A job that fails, whatever its scene holds, leaves the cache usable for the next one.
+std::string run_job(const std::string &line, scene_cache &cache, int num_threads, std::vector<unsigned char> &image);
+
+// serves the jobs of one stream until it ends, false once a `quit` line arrived
+bool serve(job_stream &stream, scene_cache &cache, int num_threads);
+
+#endif
@@ -0,0 +1,145 @@
+#include "render_schedule.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+void schedule_options(const options &opts, render_schedule &schedule)
+{
+  std::string name = opts.get("scheduler", scheduler_name(schedule.scheduler));
+  if(name == "rma")
+    schedule.scheduler = work_scheduler::rma;
+  else if(name == "distributor")
+    schedule.scheduler = work_scheduler::distributor;
+  else if(name == "steal")
+    schedule.scheduler = work_scheduler::steal;
+  else if(name == "cost")
+    schedule.scheduler = work_scheduler::cost;
+  else
+    {
+      std::cerr << "Unknown scheduler " << name << ", expected rma, distributor, steal or cost" << std::endl;
+      exit(1);
+    }
+
+  name = opts.get("split", split_name(schedule.split));
+  if(name == "rows")
+    schedule.split = frame_split::rows;
+  else if(name == "samples")
+    schedule.split = frame_split::samples;
+  else
+    {
+      std::cerr << "Unknown split " << name << ", expected rows or samples" << std::endl;
+      exit(1);
+    }
+  if(schedule.split == frame_split::samples && opts.has("wire"))
+    {
+      std::cerr << "--split=samples reduces sums of doubles, it cannot be combined with --wire" << std::endl;
+      exit(1);
+    }
+
+  name = opts.get("chunks", chunk_policy_name(schedule.chunks));
+  int i = 0;
+  while(i < num_chunk_policies && name != chunk_policy_name(static_cast<chunk_policy>(i)))
+    i++;
+  if(i == num_chunk_policies)
+    {
+      std::cerr << "Unknown chunk policy " << name << ", expected guided, factoring, trapezoid, fixed or adaptive"
+                << std::endl;
+      exit(1);
+    }
+  schedule.chunks = static_cast<chunk_policy>(i);
+  schedule.chunk_rows = opts.get_int("chunk-rows", schedule.chunk_rows);
+  schedule.tile_size = std::max(0, opts.get_int("tile", schedule.tile_size));
+}
+
+const char *scheduler_name(work_scheduler scheduler)
+{
+  switch(scheduler)
+    {
+    case work_scheduler::distributor:
+      return "distributor";
+    case work_scheduler::steal:
+      return "steal";
+    case work_scheduler::cost:
+      return "cost";
+    case work_scheduler::rma:
+    default:
+      return "rma";
+    }
+}
+
+const char *split_name(frame_split split)
+{
+  return split == frame_split::samples ? "samples" : "rows";
+}
+
+const char *chunk_policy_name(chunk_policy chunks)
+{
+  switch(chunks)
+    {
+    case chunk_policy::factoring:
+      return "factoring";
+    case chunk_policy::trapezoid:
+      return "trapezoid";
+    case chunk_policy::fixed:
+      return "fixed";
+    case chunk_policy::adaptive:
+      return "adaptive";
+    case chunk_policy::guided:
+    default:
+      return "guided";
+    }
+}
+
+int chunk_size(const render_schedule &schedule, int total, int remaining, int num_procs, int minimum,
+               double speed)
+{
+  if(remaining <= 0)
+    return 0;
+  double rows = minimum;
+  switch(schedule.chunks)
+    {
+    case chunk_policy::guided:
+      rows = remaining / (3.0 * num_procs);
+      break;
+    case chunk_policy::factoring:
+      {
+        // the batch that started with the fewest rows not below `remaining`
+        double batch = total;
+        while(batch / 2 >= remaining)
+          batch /= 2;
+        rows = std::ceil(batch / (2.0 * num_procs));
+        break;
+      }
+    case chunk_policy::trapezoid:
+      {
+        // chunk k is first - k * step; find k from the rows handed out so far,
+        // rounded since the chunks before it were cut to whole rows
+        const double first = std::max(total / (2.0 * num_procs), 1.0);
+        const double last = std::min<double>(minimum, first);
+        const double chunks = std::ceil(2.0 * total / (first + last));
+        const double step = chunks > 1 ? (first - last) / (chunks - 1) : 0;
+        const double assigned = total - remaining;
+        double k = assigned / first;
+        if(step > 0)
+          {
+            const double b = first + step / 2;
+            k = (b - std::sqrt(std::max(b * b - 2 * step * assigned, 0.0))) / step;
+          }
+        rows = first - std::round(k) * step;
+        break;
+      }
+    case chunk_policy::fixed:
+      rows = schedule.chunk_rows > 0 ? schedule.chunk_rows : minimum;
+      break;
+    case chunk_policy::adaptive:
+      rows = remaining / (3.0 * num_procs) * std::min(std::max(speed, 0.25), 4.0);
+      break;
+    }
+
+  int size = std::max(static_cast<int>(rows), minimum);
+  if(remaining - size < minimum)
+    size = remaining;
+  return std::min(size, remaining);
+}
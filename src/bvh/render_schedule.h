@@ -0,0 +1,61 @@
+#ifndef __H_RENDER_SCHEDULE__
+#define __H_RENDER_SCHEDULE__
+
+#include "options.h"
+
+// How the rows of a frame are handed out to the ranks.
+enum class work_scheduler
+{
+    distributor, // a thread on rank 0 answers work requests, its other threads render
+    rma,         // ranks claim rows from a counter in rank 0's RMA window, all of them render
+    steal,       // ranks start with a block of rows each and steal from random ranks once done
+    cost         // a low resolution pre-pass times the rows, ranks render blocks of equal cost
+};
+
+// What the ranks divide among themselves.
+enum class frame_split
+{
+    rows,   // every pixel is rendered by one rank, rows are handed out by the scheduler
+    samples // every rank renders the whole frame with its share of the samples
+};
+
+// How many rows the distributor and rma schedulers hand out per assignment.
+enum class chunk_policy
+{
+    guided,    // a third of the remaining rows per process
+    factoring, // batches of one chunk per process, each batch half of the rows left at its start
+    trapezoid, // chunks shrinking linearly from half the rows per process to the minimum
+    fixed,     // always chunk_rows rows
+    adaptive   // guided, scaled by the requesting rank's rows per second over the mean
+};
+const int num_chunk_policies = 5;
+
+struct render_schedule
+{
+    work_scheduler scheduler = work_scheduler::rma;
+    frame_split split = frame_split::rows;
+    chunk_policy chunks = chunk_policy::guided;
+    int chunk_rows = 0; // for chunk_policy::fixed, 0 for the minimum assignment
+    int tile_size = 0;  // hand out square tiles of this many pixels instead of rows, 0 for rows
+};
+
+/**
+ * @brief read --scheduler=rma|distributor|steal|cost, --split=rows|samples and
+ * --chunks=guided|factoring|trapezoid|fixed|adaptive with --chunk-rows=N and --tile=N,
+ * exits on an unknown name or on --wire with the sample split, which sends no pixels
+ */
+void schedule_options(const options &opts, render_schedule &schedule);
+
+const char *scheduler_name(work_scheduler scheduler);
+const char *split_name(frame_split split);
+const char *chunk_policy_name(chunk_policy chunks);
+
+/**
+ * @brief rows of the next assignment out of `remaining` of `total`, at least `minimum`
+ * and all of them once fewer than `minimum` would be left over. `speed` is the
+ * requesting rank's throughput over the mean of all ranks, 1 when unknown.
+ */
+int chunk_size(const render_schedule &schedule, int total, int remaining, int num_procs, int minimum,
+               double speed);
+
+#endif
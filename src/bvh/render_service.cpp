@@ -0,0 +1,69 @@
+#include "render_jobs.h"
+#include "options.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+int main(int argc, char **argv)
+{
+  options opts(argc, argv);
+  if(opts.positional().size() < 1)
+    {
+      std::cerr << "Usage:" << argv[0] << " num_threads [--socket=path] [--cache=N]" << std::endl
+                << "Job lines: --scene=file [--width=N] [--height=N] [--spp=N] [--depth=N] [--lookfrom=x,y,z]"
+                << " [--lookat=x,y,z] [--vfov=D] [--aperture=A] [--focus=F] [--region=x0,y0,w,h] [--seed=N]"
+                << " [--format=p3|p6|pfm|qoi] [--output=file], or quit" << std::endl;
+      exit(1);
+    }
+  int num_threads = std::atoi(opts.positional()[0].c_str());
+  scene_cache cache(opts.get_int("cache", 4));
+  // a client that goes away must not end the service
+  std::signal(SIGPIPE, SIG_IGN);
+
+  const std::string socket_path = opts.get("socket", "");
+  if(socket_path.empty())
+    {
+      job_stream stream(STDIN_FILENO, STDOUT_FILENO);
+      serve(stream, cache, num_threads);
+      return 0;
+    }
+
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if(socket_path.size() >= sizeof(address.sun_path))
+    {
+      std::cerr << "Socket path " << socket_path << " is too long" << std::endl;
+      exit(1);
+    }
+  std::strcpy(address.sun_path, socket_path.c_str());
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(socket_path.c_str());
+  if(listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0
+     || listen(listener, 16) != 0)
+    {
+      std::cerr << "Cannot listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+      exit(1);
+    }
+  std::cerr << "Listening on " << socket_path << " with " << num_threads << " threads\n";
+
+  bool running = true;
+  while(running)
+    {
+      int connection = accept(listener, nullptr, nullptr);
+      if(connection < 0)
+        continue;
+      job_stream stream(connection, connection);
+      running = serve(stream, cache, num_threads);
+      close(connection);
+    }
+  close(listener);
+  unlink(socket_path.c_str());
+  return 0;
+}
@@ -8,379 +8,220 @@
 #include <ctime>
 #include "boundable.h"
 #include <omp.h>
-#include <thread>
-#include <atomic>
-#include <condition_variable>
 #include "ray_tracing.h"
-#define RENDER_COMPLETE std::numeric_limits<int>::min()
+#include "mpi_render.h"
+#include "mpi_scene.h"
+#include "mpi_data_parallel.h"
+#include "mpi_animation.h"
+#include "flat_scene.h"
+#include <memory>
+#include "checkpoint.h"
+#include "render_budget.h"
+#include "options.h"
+
+typedef std::function<frame_times(const std::function<void(const color *)> &)> frame_renderer;
+
+// renders one frame with `render`, rank 0 writes it and prints the timings of all ranks;
+// `payload` names what the ranks sent, for BYTES_SENT
+void raytracing(const traceConfig config, const frame_renderer &render, const char *payload){
 
-static color ray_color(const ray &r, BVH &world, int depth)
-{
-  hit_record rec;
-  Sphere *hitObject = nullptr;
+  const int image_width = config.width;
+  const int image_height = config.height;
+  const int samples_per_pixel = config.samplePerPixel;
 
-  if (depth <= 0)
-    return color(0, 0, 0);
+  frame_times times = render([&](const color *output_image)
+                             {
+                               write_image(config.output, output_image, image_width, image_height,
+                                           samples_per_pixel);
+                             });
+  double t_elapsed = times.render;
 
-  if (world.intersect(r, &hitObject, rec))
-  {
-    ray scattered;
-    color attenuation;
-    if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-    {
-      return attenuation * ray_color(scattered, world, depth - 1);
-    }
-    else
+  double busy = times.all - times.prepass - times.idle;
+  double *receive_data = nullptr;
+  double *receive_idle = nullptr;
+  double *receive_busy = nullptr;
+  uint64_t *receive_bytes = nullptr;
+
+  if(config.myRank == 0)
     {
-      return color(0, 0, 0);
+      receive_data = new double[config.numProcs];
+      receive_idle = new double[config.numProcs];
+      receive_busy = new double[config.numProcs];
+      receive_bytes = new uint64_t[config.numProcs];
     }
-  }
 
-  //otherwise return the background color
-  vec3 unit_direction = unit_vector(r.direction());
-  auto t = 0.5 * (unit_direction.y() + 1.0);
-  return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
-}
+  MPI_Gather(&t_elapsed,
+             1,
+             MPI_DOUBLE,
+             receive_data,
+             1,
+             MPI_DOUBLE,
+             0,
+             MPI_COMM_WORLD
+             );
+  MPI_Gather(&times.idle, 1, MPI_DOUBLE,
+             receive_idle, 1, MPI_DOUBLE,
+             0, MPI_COMM_WORLD);
+  MPI_Gather(&busy, 1, MPI_DOUBLE,
+             receive_busy, 1, MPI_DOUBLE,
+             0, MPI_COMM_WORLD);
+  MPI_Gather(&times.bytesSent, 1, MPI_UINT64_T,
+             receive_bytes, 1, MPI_UINT64_T,
+             0, MPI_COMM_WORLD);
 
-// a global distributor that processes request work from
-void work_distributor_loop(const traceConfig& config,
-                           int minimum_assignment
-                           )
-{
-  const int total_rows = config.height;
-  // one processor is the work distributor, will not be doing any work
-  const int num_procs = config.numProcs - 1;
-  int remaining_rows = total_rows;
-  int finish_messages_distributed = 0;
-  int incoming_request_buf = 0;
-  int outgoing_request_buf[2];
-  int last_row_assigned = 0;
-
-  if(num_procs == 1)
-    minimum_assignment = total_rows;
-
-  while(finish_messages_distributed < num_procs)
+  if(config.myRank == 0)
     {
-      // receive a work request from some process
-      MPI_Recv(&incoming_request_buf,
-               1, MPI_INT,
-               MPI_ANY_SOURCE,
-               MPI_ANY_TAG,
-               MPI_COMM_WORLD,
-               MPI_STATUS_IGNORE
-               );
-
-      int requesting_process = incoming_request_buf;
-      // calculate the work that should be distributed
-      int num_rows = remaining_rows / (3*num_procs);
-
-      if(num_rows > 0)
+      std::cerr << "TIME_ALL: " << times.all << "\n";
+      if(times.prepass > 0)
+        std::cerr << "TIME_PREPASS: " << times.prepass << "\n";
+      std::cerr << "IMBALANCE: " << render_imbalance(receive_busy, config.numProcs) << "\n";
+
+      for(int i = 0; i < config.numProcs; i++)
         {
-          if(num_rows < minimum_assignment)
-            {
-              num_rows = minimum_assignment;
-            }
-          outgoing_request_buf[0] = last_row_assigned;
-          // each process does inclusive render of rows assigned to it
-          outgoing_request_buf[1] = last_row_assigned + num_rows;
-          last_row_assigned += num_rows - 1;
-          remaining_rows -= num_rows;
-          if(remaining_rows < minimum_assignment)
-            {
-            outgoing_request_buf[1] = total_rows - 1;
-            remaining_rows = 0;
-            }
+          std::cerr << "TIME_PROCESS: " << i << " " << receive_data[i] << "\n";
         }
-      else
+      for(int i = 0; i < config.numProcs; i++)
         {
-          outgoing_request_buf[0] = 0;
-          outgoing_request_buf[1] = 0;
-          finish_messages_distributed++;
+          std::cerr << "TIME_IDLE: " << i << " " << receive_idle[i] << "\n";
+        }
+      for(int i = 0; i < config.numProcs; i++)
+        {
+          std::cerr << "BYTES_SENT: " << i << " " << receive_bytes[i] << " (" << payload << ")\n";
         }
-
-      MPI_Send(outgoing_request_buf,
-               2, MPI_INT,
-               requesting_process, 0,
-               MPI_COMM_WORLD
-               );
     }
+
+  delete[] receive_data;
+  delete[] receive_idle;
+  delete[] receive_busy;
+  delete[] receive_bytes;
 }
 
-void request_work(int myRank,
-                  std::atomic_int& row_iter,
-                  std::atomic_int& minimum_row
-                  )
+// Progressive variant: every pass is a full distributed frame. Rank 0 owns the
+// accumulation buffer and the checkpoint, and decides when to stop. With a
+// deadline rank 0 also sizes every pass to what its clock says is left: the
+// first pass of one sample measures the cost of a sample, and the last one
+// shrinks to end before the image has to be written.
+void raytracing_progressive(const traceConfig config, BVH &world, int num_threads,
+                            const progressiveConfig &progressive, const render_schedule &schedule)
 {
-
-  // there is more work to be done
-  int requestor = myRank;
-  int received_data[2];
-
-  MPI_Send(&requestor,
-           1, MPI_INT,
-           0, 0,
-           MPI_COMM_WORLD
-           );
-  MPI_Recv(received_data,
-           2, MPI_INT,
-           0, 0,
-           MPI_COMM_WORLD,
-           MPI_STATUS_IGNORE
-           );
-
-  if(received_data[0] == 0 && received_data[1] == 0)
-    {
-      row_iter = RENDER_COMPLETE;
-      minimum_row = RENDER_COMPLETE;
-    }
-  else
+  render_budget budget(progressive.deadline);
+  render_checkpoint state;
+  if(config.myRank == 0)
     {
-      row_iter = received_data[1];
-      minimum_row = received_data[0];
+      state = begin_progressive(config, progressive);
+      if(progressive.deadline > 0)
+        budget.reserve_output(config.output, config.width, config.height);
     }
-}
-
-
-void render_loop(const traceConfig& config, BVH& world,
-                 color *output_image,
-                 std::atomic_int& row_iter, std::atomic_int& row_end,
-                 std::atomic<bool>& render_complete,
-                 std::condition_variable& get_work_var,
-                 std::mutex& wait_mutex,
-                 std::atomic_int& prev_row_start,
-                 std::atomic_int& prev_row_end,
-                 std::atomic_int& threads_seen,
-                 int num_threads,
-                 MPI_Datatype &color_type,
-                 MPI_Win &window
-                 )
-{
-  const camera& cam = config.cam;
-  const int samples_per_pixel = config.samplePerPixel;
-  const int image_width = config.width;
-  const int image_height = config.height;
-  const int max_depth = config.traceDepth;
-  int last_row_end = prev_row_end;
-  int last_row_start = prev_row_start;
 
-  int my_iter = 0;
+  int pass_state[2] = {state.passes_done, state.samples_per_pass};
+  MPI_Bcast(pass_state, 2, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&state.seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+  state.passes_done = pass_state[0];
+  state.samples_per_pass = pass_state[1];
+
+  const int samples_per_pass = state.samples_per_pass;
+  const int total_passes = (config.samplePerPixel + samples_per_pass - 1) / samples_per_pass;
+  const double frame_pixels = static_cast<double>(config.width) * config.height;
+  int samples_done = state.passes_done * samples_per_pass;
+  traceConfig pass_config = config;
+  pass_config.seed = state.seed;
+  // passes are summed on rank 0, which needs the linear values
+  pass_config.wire = wire_format::float32;
 
- RENDER_LOOP:
-  my_iter = row_iter--;
-  while(my_iter >= row_end && my_iter >= 0)
+  double tstart = omp_get_wtime();
+  while(true)
     {
-      if(render_complete)
+      // stop flag and samples of the next pass
+      int next[2] = {0, 0};
+      if(config.myRank == 0)
         {
-          threads_seen = 0;
-          get_work_var.notify_all();
-          return;
+          next[1] = std::min(samples_per_pass, config.samplePerPixel - samples_done);
+          if(progressive.deadline > 0)
+            next[1] = state.passes_done == 0 ? 1 : budget.samples_that_fit(frame_pixels, next[1]);
+          next[0] = next[1] <= 0 || stop_requested();
         }
-
-      for(int i = 0; i < image_width; i++)
+      MPI_Bcast(next, 2, MPI_INT, 0, MPI_COMM_WORLD);
+      if(next[0])
+        break;
+
+      const int pass_samples = next[1];
+      pass_config.pass = state.passes_done;
+      pass_config.samplePerPixel = pass_samples;
+
+      double pass_start = omp_get_wtime();
+      render_frame(pass_config, world, num_threads,
+                   [&](const color *output_image)
+                   {
+                     for(int i = 0; i < state.image.size(); i++)
+                       state.image.add(i, output_image[i], pass_samples);
+                   },
+                   schedule);
+      state.passes_done++;
+      samples_done += pass_samples;
+
+      if(config.myRank == 0)
         {
-          color pixel_color(0, 0, 0);
-          for(int s = 0; s < samples_per_pixel; ++s)
-            {
-              auto u = (i + random_double()) / (image_width - 1);
-              auto v = (my_iter + random_double()) / (image_height - 1);
-
-              ray r = cam.get_ray(u, v);
-              pixel_color += ray_color(r, world, max_depth);
-            }
-          int access_idx = ((image_height - 1 - my_iter)*image_width + i);
-          output_image[((image_height - 1 - my_iter)*image_width + i)] = pixel_color;
+          budget.record(omp_get_wtime() - pass_start, frame_pixels * pass_samples);
+          checkpoint_progressive(progressive, state, total_passes);
+          if(progressive.deadline > 0)
+            std::cerr << "Pass " << state.passes_done << ", " << samples_done << " samples, "
+                      << budget.remaining() << " s left\n";
+          else
+            std::cerr << "Pass " << state.passes_done << "/" << total_passes << "\n";
         }
-
-      my_iter = row_iter--;
-    }
-
-  ++threads_seen;
-
-  if(threads_seen == num_threads)
-    {
-      last_row_end = prev_row_end;
-      last_row_start = prev_row_start;
-
-      request_work(config.myRank,
-                   row_iter,
-                   row_end
-                   );
-
-      int prev_end = row_end;
-      int prev_start = row_iter;
-
-      prev_row_end = prev_end;
-      prev_row_start = prev_start;
-
-      int offset_pixels = (image_height - last_row_start - 1) * image_width;
-      int num_pixels = (1 + last_row_start - last_row_end) * image_width;
-      threads_seen = 0;
-
-      // done: the start and end are eqal to some value
-      if(row_end == RENDER_COMPLETE && row_iter == RENDER_COMPLETE)
-        render_complete = true;
-
-      get_work_var.notify_all();
-
-      if(!(last_row_start == 0 && last_row_end == 0))
-        {
-          MPI_Put(output_image + offset_pixels,
-                  num_pixels,
-                  color_type, 0,
-                  offset_pixels,
-                  num_pixels,
-                  color_type, window
-                  );
-        }
-
-      if(render_complete)
-        return;
-    }
-  else
-    {
-      std::unique_lock<std::mutex> ul(wait_mutex);
-      get_work_var.wait(ul, [&] {return threads_seen == 0 || render_complete.load();});
-    }
-  goto RENDER_LOOP;
-}
-
-
-void raytracing(const traceConfig config, BVH &world, int num_threads){
-
-    const camera &cam = config.cam;
-    const int image_width = config.width;
-    const int image_height = config.height;
-    const int max_depth = config.traceDepth;
-    const int samples_per_pixel = config.samplePerPixel;
-    const int rows_per_process = image_height / config.numProcs;
-
-    if(config.myRank == 0)
-      {
-        std ::cout << "P3\n"
-                   << image_width << ' ' << image_height << "\n255\n";
-      }
-
-  MPI_Win window;
-  MPI_Datatype MPI_COLOR;
-  color *output_image = nullptr;
-  MPI_Alloc_mem(sizeof(color) * image_height * image_width,
-                MPI_INFO_NULL,
-                &output_image
-                );
-  for(int i = 0; i < image_height * image_width; i++)
-    {
-      output_image[i] = color(255, 0, 255);
     }
 
-  MPI_Win_create(output_image,
-                 sizeof(color) * image_height * image_width,
-                 sizeof(color),
-                 MPI_INFO_NULL, MPI_COMM_WORLD,
-                 &window);
-
-  MPI_Type_contiguous(3, MPI_DOUBLE, &MPI_COLOR);
-  MPI_Type_commit(&MPI_COLOR);
-
-
-  double tstart = omp_get_wtime();
-  MPI_Win_fence(0, window);
-  std::atomic_int remaining_iters{-1};
-  std::atomic_int row_end{-1};
-
-  // TODO: change this
-  // TODO: add thread_config as analog to traceConfig
-  int minimum_distribution = 2*num_threads;
   if(config.myRank == 0)
     {
-      std::thread work_distributor = std::thread(work_distributor_loop,
-                                                 std::ref(config),
-                                                 minimum_distribution
-                                                 );
-      work_distributor.join();
+      write_image(config.output, state.image);
+      if(samples_done < config.samplePerPixel)
+        std::cerr << "Stopped after " << state.passes_done << " passes, " << samples_done << " of "
+                  << config.samplePerPixel << " samples\n";
+      std::cerr << "SPP_ACHIEVED: " << samples_summary(state.image) << "\n";
+      std::cerr << "TIME_ALL: " << omp_get_wtime() - tstart << "\n";
     }
-  else
-    {
-          std::atomic<bool> render_complete{false};
-          std::condition_variable work_var;
-          std::mutex wait_mutex;
-          std::atomic_int prev_row_start{0};
-          std::atomic_int prev_row_end{0};
-          std::atomic_int threads_seen{0};
-
-          std::thread threads[num_threads];
-
-          for(int i = 0; i < num_threads; i++)
-            {
-              threads[i] = std::thread(render_loop,
-                                       std::ref(config),
-                                       std::ref(world),
-                                       output_image,
-                                       std::ref(remaining_iters),
-                                       std::ref(row_end),
-                                       std::ref(render_complete),
-                                       std::ref(work_var),
-                                       std::ref(wait_mutex),
-                                       std::ref(prev_row_start),
-                                       std::ref(prev_row_end),
-                                       std::ref(threads_seen),
-                                       num_threads,
-                                       std::ref(MPI_COLOR),
-                                       std::ref(window)
-                                       );
-            }
-          for(int i = 0; i < num_threads; i++)
-            {
-              threads[i].join();
-            }
+}
 
-    }
-  double tend = omp_get_wtime();
-  MPI_Win_fence(0, window);
-  double t_elapsed = tend - tstart;
-  double tend_all = omp_get_wtime();
+// Renders a camera fly-through and prints the frames each rank rendered and the
+// overall rate.
+void raytracing_animation(const traceConfig config, BVH &world, int num_threads, const animation &anim)
+{
+  animation_times times = render_animation(config, world, num_threads, anim);
 
-  double *receive_data = nullptr;
+  std::vector<int> frames(config.numProcs);
+  std::vector<double> idle(config.numProcs);
+  double my_idle = times.all - times.render;
+  MPI_Gather(&times.frames, 1, MPI_INT, frames.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Gather(&my_idle, 1, MPI_DOUBLE, idle.data(), 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 
   if(config.myRank == 0)
     {
-      receive_data = new double[config.numProcs];
+      std::cerr << "TIME_ALL: " << times.all << "\n";
+      std::cerr << "FRAMES_PER_HOUR: " << anim.frames * 3600.0 / times.all << "\n";
+      for(int i = 0; i < config.numProcs; i++)
+        std::cerr << "FRAMES: " << i << " " << frames[i] << "\n";
+      for(int i = 0; i < config.numProcs; i++)
+        std::cerr << "TIME_IDLE: " << i << " " << idle[i] << "\n";
     }
+}
 
-  MPI_Gather(&t_elapsed,
-             1,
-             MPI_DOUBLE,
-             receive_data,
-             1,
-             MPI_DOUBLE,
-             0,
-             MPI_COMM_WORLD
-             );
-
-  if(config.myRank == 0)
-    {
-      for(int i = 0; i < image_height * image_width; i++)
-        write_color(std::cout, output_image[i], samples_per_pixel);
-  }
-
-  if(config.myRank == 0)
+// Rank 0 loads the scene, builds the octree and flattens both
+static std::vector<char> flat_scene_on_rank0(const std::string &sceneFile)
+{
+  int my_rank = 0;
+  MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+  std::vector<char> flat_scene;
+  if(my_rank == 0)
     {
-      std::cerr << "TIME_ALL: " << tend_all - tstart << "\n";
-
-      for(int i = 0; i < config.numProcs; i++)
-        {
-          std::cerr << "TIME_PROCESS: " << i << " " << receive_data[i] << "\n";
-        }
+      ShapeDataIO io;
+      std::vector<Sphere*> scene_spheres = io.load_scene(sceneFile);
+      BVH world(scene_spheres);
+      flattenScene(scene_spheres, world, flat_scene);
+      io.clear_scene(scene_spheres);
     }
-
-  MPI_Win_free(&window);
-  MPI_Free_mem(output_image);
-  MPI_Type_free(&MPI_COLOR);
-
-  delete[] receive_data;
+  return flat_scene;
 }
 
-
-
 int main(int argc, char **argv)
 {
 
@@ -389,8 +230,12 @@ int main(int argc, char **argv)
 
   assert(multithread_support == MPI_THREAD_SERIALIZED);
 
-  if(argc<3){
-    std::cerr<<"Usage:"<<argv[0]<<" sceneFile num_threads"<<std::endl;
+  options opts(argc, argv);
+  if(opts.positional().size()<2){
+    std::cerr<<"Usage:"<<argv[0]<<" sceneFile num_threads [--width=N] [--spp=N]"
+             <<" [--progressive] [--deadline=seconds] [--pass-samples=N] [--checkpoint=file] [--checkpoint-every=N] [--resume] [--seed=N]"
+             <<" [--format=p3|p6|pfm|qoi] [--output=file] [--wire=float|half|rgbe] [--scene-bcast|--scene-shared] [--scheduler=rma|distributor|steal|cost] [--split=rows|samples] [--chunks=guided|factoring|trapezoid|fixed|adaptive] [--chunk-rows=N] [--tile=N]"
+             <<" [--data-parallel] [--animate=camera_path] [--frames=N]"<<std::endl;
     exit(1);
   }
 
@@ -399,28 +244,85 @@ int main(int argc, char **argv)
   MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
   MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
 
-  std::string sceneFile = argv[1];
+  std::string sceneFile = opts.positional()[0];
   ShapeDataIO io;
-  std::vector<Sphere*> scene_spheres = io.load_scene(sceneFile);
-  int num_threads = std::atoi(argv[2]);
+  std::vector<Sphere*> scene_spheres;
+  std::vector<char> flat_scene;
+  std::unique_ptr<node_shared_scene> shared_scene;
+  std::unique_ptr<BVH> world;
+  std::unique_ptr<scene_partition> partition;
+  const bool data_parallel = opts.has("data-parallel");
+  const bool progressive_requested = opts.has("progressive") || opts.has("deadline");
+  if(data_parallel && (opts.has("scene-shared") || opts.has("scene-bcast") || progressive_requested
+                        || opts.has("animate")))
+    {
+      if(my_rank == 0)
+        std::cerr << "--data-parallel cannot be combined with --scene-shared, --scene-bcast, --progressive,"
+                  << " --deadline or --animate" << std::endl;
+      exit(1);
+    }
+  if(opts.has("animate") && progressive_requested)
+    {
+      if(my_rank == 0)
+        std::cerr << "--animate cannot be combined with --progressive or --deadline" << std::endl;
+      exit(1);
+    }
+  double scene_start = MPI_Wtime();
+  if(data_parallel)
+    {
+      // every rank reads one block of the spheres and keeps its spatial share of all of them
+      uint64_t total_spheres = 0;
+      scene_spheres = io.load_scene_part(sceneFile, my_rank, nprocs, total_spheres);
+      partition.reset(new scene_partition(scene_spheres, total_spheres, MPI_COMM_WORLD));
+    }
+  else if(opts.has("scene-shared"))
+    {
+      // one copy per node, the BVHs read it in place
+      shared_scene.reset(new node_shared_scene(flat_scene_on_rank0(sceneFile), MPI_COMM_WORLD));
+      world.reset(new BVH(shared_scene->data(), shared_scene->size()));
+    }
+  else if(opts.has("scene-bcast"))
+    {
+      // one copy per process
+      flat_scene = flat_scene_on_rank0(sceneFile);
+      broadcast_buffer(flat_scene, 0, MPI_COMM_WORLD);
+      world.reset(new BVH(flat_scene.data(), flat_scene.size()));
+    }
+  else
+    {
+      scene_spheres = io.load_scene(sceneFile);
+      world.reset(new BVH(scene_spheres));
+    }
+  double scene_time = MPI_Wtime() - scene_start;
+  int num_threads = std::atoi(opts.positional()[1].c_str());
 
   if(my_rank == 0)
     {
       std::cerr << "Rendering scene " << sceneFile
                 << " using " << num_threads
                 << " threads per process, " << nprocs << " processes.\n";
+      std::cerr << "TIME_SCENE: " << scene_time << "\n";
+      if(shared_scene)
+        std::cerr << "SCENE_BYTES: " << shared_scene->size() << " per node\n";
+      else if(!flat_scene.empty())
+        std::cerr << "SCENE_BYTES: " << flat_scene.size() << " per process\n";
+    }
+  if(partition)
+    {
+      uint64_t local = partition->local_spheres();
+      uint64_t most = 0;
+      MPI_Reduce(&local, &most, 1, MPI_UINT64_T, MPI_MAX, 0, MPI_COMM_WORLD);
+      if(my_rank == 0)
+        std::cerr << "SCENE_SPHERES: " << most << " of " << partition->total_spheres() << " on the fullest rank\n";
     }
 
     // Image
     const auto aspect_ratio = 3.0 / 2.0;
-    const int image_width = 1200;
+    const int image_width = opts.get_int("width", 1200);
     const int image_height = static_cast<int>(image_width / aspect_ratio);
-    const int samples_per_pixel = 500;
+    const int samples_per_pixel = opts.get_int("spp", 500);
     const int max_depth = 50;
 
-  // World
-  BVH world(scene_spheres);
-
   point3 lookfrom(13, 2, 3);
   point3 lookat(0, 0, 0);
   vec3 vup(0, 1, 0);
@@ -429,13 +331,44 @@ int main(int argc, char **argv)
   camera cam(lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus);
 
   traceConfig config(cam, image_width, image_height, max_depth, samples_per_pixel, nprocs, my_rank, num_threads);
-
-  raytracing(config, world, num_threads);
+  output_options(opts, config.output);
+  wire_options(opts, config.wire);
+  render_schedule schedule;
+  schedule_options(opts, schedule);
+
+  progressiveConfig progressive;
+  animation anim;
+  anim.aperture = aperture;
+  anim.focus_dist = dist_to_focus;
+  if(animation_options(opts, anim))
+    {
+      raytracing_animation(config, *world, num_threads, anim);
+    }
+  else if(progressive_options(opts, progressive))
+    {
+      install_stop_handler();
+      raytracing_progressive(config, *world, num_threads, progressive, schedule);
+    }
+  else if(partition)
+    {
+      raytracing(config, [&](const std::function<void(const color *)> &on_complete)
+                 { return render_data_parallel(config, *partition, num_threads, on_complete); },
+                 "rays");
+    }
+  else
+    {
+      raytracing(config, [&](const std::function<void(const color *)> &on_complete)
+                 { return render_frame(config, *world, num_threads, on_complete, schedule); },
+                 schedule.split == frame_split::samples ? "double sums" : wire_name(config.wire));
+    }
   if(my_rank == 0)
     {
       std::cerr << "\nDone.\n";
     }
 
+  world.reset();
+  partition.reset();
+  shared_scene.reset();
   io.clear_scene(scene_spheres);
   MPI_Finalize();
 }
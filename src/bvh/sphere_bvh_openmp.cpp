@@ -7,32 +7,65 @@
 #include "color.h"
 #include <ctime>
 #include "boundable.h"
+#include "options.h"
 
 int main(int argc, char** argv)
 {
 
-  if(argc<3){
-    std::cerr<<"Usage:"<<argv[0]<<" sceneFile num_threads"<<std::endl;
+  options opts(argc, argv);
+  if(opts.positional().size()<2){
+    std::cerr<<"Usage:"<<argv[0]<<" sceneFile num_threads [--width=N] [--spp=N]"
+             <<" [--progressive] [--deadline=seconds] [--pass-samples=N] [--checkpoint=file] [--checkpoint-every=N] [--resume] [--seed=N]"
+             <<" [--denoise] [--denoise-iterations=N] [--reference=image.ppm]"
+             <<" [--crop=x0,y0,w,h[+...]] [--crop-tiles=size:id[,id...]] [--patch=frame.ppm]"
+             <<" [--format=p3|p6|pfm|qoi] [--output=file]"<<std::endl;
     exit(1);
   }
 
   ShapeDataIO shapeIO;
-  std::string sceneFile = argv[1];
+  std::string sceneFile = opts.positional()[0];
   std::vector<Sphere*> scene_spheres = shapeIO.load_scene(sceneFile);
-  int num_threads = std::atoi(argv[2]);
+  int num_threads = std::atoi(opts.positional()[1].c_str());
   std::cerr << "Rendering scene " << sceneFile << " using " << num_threads << " threads\n";
 
     camera cam = camera::getDefault();
     // Image
-    const int image_width = 1200;
+    const int image_width = opts.get_int("width", 1200);
     const int image_height = static_cast<int>(image_width / cam.aspect_ratio);
-    const int samples_per_pixel = 500;
+    const int samples_per_pixel = opts.get_int("spp", 500);
     const int max_depth = 10;
 
     // World
     BVH world(scene_spheres);
-    traceConfig config(cam, image_width, image_height, max_depth, samples_per_pixel, num_threads, 0, 1);
-    raytracing_bvh(config, world);
+    progressiveConfig progressive;
+    std::vector<cropRect> crops;
+    if(crop_options(opts, image_width, image_height, crops)){
+      traceConfig config(cam, image_width, image_height, max_depth, samples_per_pixel, num_threads, 0, 1, true);
+      output_options(opts, config.output);
+      const std::string patch = opts.get("patch", "");
+      // a patched frame replaces its file unless --output says otherwise
+      if(!patch.empty() && !opts.has("output")){
+        config.output.path = patch;
+        auto dot = patch.rfind('.');
+        if(!opts.has("format") && dot != std::string::npos)
+          parse_image_format(patch.substr(dot + 1), config.output.format);
+      }
+      raytracing_bvh_crop(config, world, crops, patch);
+    }else if(progressive_options(opts, progressive)){
+      install_stop_handler();
+      traceConfig config(cam, image_width, image_height, max_depth, samples_per_pixel, num_threads, 0, 1, true);
+      output_options(opts, config.output);
+      raytracing_bvh_progressive(config, world, progressive);
+    }else{
+      denoiseConfig denoise;
+      image_output output;
+      bool print_output = output_options(opts, output);
+      print_output = denoise_options(opts, denoise) || print_output;
+      traceConfig config(cam, image_width, image_height, max_depth, samples_per_pixel, num_threads, 0, 1, print_output);
+      config.denoise = denoise;
+      config.output = output;
+      raytracing_bvh(config, world);
+    }
     std::cerr << "\nDone.\n";
     shapeIO.clear_scene(scene_spheres);
 }
\ No newline at end of file
@@ -7,33 +7,45 @@
 #include "color.h"
 #include <ctime>
 #include "boundable.h"
+#include "options.h"
 
 int main(int argc, char** argv)
 {
 
-  if(argc<4){
-    std::cerr<<"Usage:"<<argv[0]<<" sceneFile num_threads tileSize"<<std::endl;
+  options opts(argc, argv);
+  if(opts.positional().size()<3){
+    std::cerr<<"Usage:"<<argv[0]<<" sceneFile num_threads tileSize [--width=N] [--spp=N]"
+             <<" [--deadline=seconds] [--pass-samples=N] [--seed=N]"
+             <<" [--denoise] [--denoise-iterations=N] [--reference=image.ppm]"
+             <<" [--format=p3|p6|pfm|qoi] [--output=file]"<<std::endl;
     exit(1);
   }
 
   ShapeDataIO shapeIO;
-  std::string sceneFile = argv[1];
+  std::string sceneFile = opts.positional()[0];
   std::vector<Sphere*> scene_spheres = shapeIO.load_scene(sceneFile);
-  int num_threads = std::atoi(argv[2]);
-  int tileSize = std::atoi(argv[3]);
+  int num_threads = std::atoi(opts.positional()[1].c_str());
+  int tileSize = std::atoi(opts.positional()[2].c_str());
   std::cerr << "Rendering scene " << sceneFile << " using " << num_threads << " threads with tilesize "<<tileSize<<std::endl;
 
     camera cam = camera::getDefault();
     // Image
-    const int image_width = 640;
+    const int image_width = opts.get_int("width", 640);
     const int image_height = static_cast<int>(image_width / cam.aspect_ratio);
-    const int samples_per_pixel = 100;
+    const int samples_per_pixel = opts.get_int("spp", 100);
     const int max_depth = 10;
 
     // World
     BVH world(scene_spheres);
     traceConfig config(cam, image_width, image_height, max_depth, samples_per_pixel, num_threads, 0, 1, true);
-    raytracing_bvh_tiled(config, world,tileSize);
+    output_options(opts, config.output);
+    progressiveConfig progressive;
+    if(progressive_options(opts, progressive) && progressive.deadline > 0){
+      raytracing_bvh_tiled_deadline(config, world, tileSize, progressive);
+    }else{
+      denoise_options(opts, config.denoise);
+      raytracing_bvh_tiled(config, world,tileSize);
+    }
     std::cerr << "\nDone.\n";
     shapeIO.clear_scene(scene_spheres);
 }
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include "camera_path.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+bool load_camera_path(const std::string &path, std::vector<camera_key> &keys)
+{
+  std::ifstream file(path);
+  if(!file.good())
+    {
+      std::cerr << "Cannot read camera path " << path << std::endl;
+      return false;
+    }
+  keys.clear();
+  std::string line;
+  int line_number = 0;
+  while(std::getline(file, line))
+    {
+      line_number++;
+      std::istringstream fields(line);
+      std::string first;
+      if(!(fields >> first) || first[0] == '#')
+        continue;
+
+      camera_key key;
+      key.vfov = 20;
+      fields.clear();
+      fields.seekg(0);
+      if(!(fields >> key.time >> key.lookfrom.e[0] >> key.lookfrom.e[1] >> key.lookfrom.e[2]
+           >> key.lookat.e[0] >> key.lookat.e[1] >> key.lookat.e[2]))
+        {
+          std::cerr << path << ":" << line_number << ": expected time, lookfrom and lookat" << std::endl;
+          return false;
+        }
+      fields >> key.vfov;
+      if(!keys.empty() && key.time <= keys.back().time)
+        {
+          std::cerr << path << ":" << line_number << ": keyframe times must increase" << std::endl;
+          return false;
+        }
+      keys.push_back(key);
+    }
+  if(keys.empty())
+    std::cerr << "Camera path " << path << " has no keyframes" << std::endl;
+  return !keys.empty();
+}
+
+// uniform Catmull-Rom segment from p1 (s = 0) to p2 (s = 1)
+static vec3 catmull_rom(const vec3 &p0, const vec3 &p1, const vec3 &p2, const vec3 &p3, double s)
+{
+  const double s2 = s * s;
+  const double s3 = s2 * s;
+  return 0.5 * ((2 * p1) + (p2 - p0) * s + (2 * p0 - 5 * p1 + 4 * p2 - p3) * s2
+                + (3 * p1 - p0 - 3 * p2 + p3) * s3);
+}
+
+camera camera_at(const std::vector<camera_key> &keys, double time, double aspect_ratio,
+                 double aperture, double focus_dist)
+{
+  const vec3 vup(0, 1, 0);
+  const int n = static_cast<int>(keys.size());
+  if(n == 1 || time <= keys.front().time)
+    return camera(keys.front().lookfrom, keys.front().lookat, vup, keys.front().vfov, aspect_ratio, aperture,
+                  focus_dist);
+  if(time >= keys.back().time)
+    return camera(keys.back().lookfrom, keys.back().lookat, vup, keys.back().vfov, aspect_ratio, aperture,
+                  focus_dist);
+
+  int i = 0;
+  while(keys[i + 1].time < time)
+    i++;
+  const camera_key &a = keys[i];
+  const camera_key &b = keys[i + 1];
+  const double s = (time - a.time) / (b.time - a.time);
+  // the end segments mirror their neighbour for the missing outer control point
+  point3 from_before = i > 0 ? keys[i - 1].lookfrom : 2 * a.lookfrom - b.lookfrom;
+  point3 at_before = i > 0 ? keys[i - 1].lookat : 2 * a.lookat - b.lookat;
+  point3 from_after = i + 2 < n ? keys[i + 2].lookfrom : 2 * b.lookfrom - a.lookfrom;
+  point3 at_after = i + 2 < n ? keys[i + 2].lookat : 2 * b.lookat - a.lookat;
+
+  point3 lookfrom = catmull_rom(from_before, a.lookfrom, b.lookfrom, from_after, s);
+  point3 lookat = catmull_rom(at_before, a.lookat, b.lookat, at_after, s);
+  double vfov = a.vfov + (b.vfov - a.vfov) * s;
+  return camera(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, focus_dist);
+}
+
+double frame_time(const std::vector<camera_key> &keys, int frame, int frames)
+{
+  if(frames <= 1)
+    return keys.front().time;
+  return keys.front().time + (keys.back().time - keys.front().time) * frame / (frames - 1);
+}
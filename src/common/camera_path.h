@@ -0,0 +1,38 @@
+#ifndef CAMERA_PATH_HH_INCLUDED
+#define CAMERA_PATH_HH_INCLUDED
+
+#include "vec3.h"
+#include "ray.h"
+#include "camera.h"
+#include <string>
+#include <vector>
+
+// One keyframe of a camera fly-through.
+struct camera_key
+{
+  double time;
+  point3 lookfrom;
+  point3 lookat;
+  double vfov;
+};
+
+/**
+ * @brief read a camera path, one keyframe per line as
+ * `time fromx fromy fromz atx aty atz [vfov]`, times increasing. Empty lines and
+ * lines starting with # are skipped, vfov defaults to 20. Returns false if the
+ * file cannot be read or holds no valid keyframe.
+ */
+bool load_camera_path(const std::string &path, std::vector<camera_key> &keys);
+
+/**
+ * @brief the camera at `time` along keys, a Catmull-Rom spline through the
+ * positions and targets and linear in the field of view. Times outside the path
+ * keep the first or last keyframe.
+ */
+camera camera_at(const std::vector<camera_key> &keys, double time, double aspect_ratio,
+                 double aperture, double focus_dist);
+
+// time of frame `frame` of `frames` spread evenly from the first keyframe to the last
+double frame_time(const std::vector<camera_key> &keys, int frame, int frames);
+
+#endif // CAMERA_PATH_HH_INCLUDED
@@ -0,0 +1,96 @@
+#include "checkpoint.h"
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+static const char checkpoint_magic[8] = {'P', 'R', 'C', 'H', 'K', 'P', 'T', '1'};
+
+struct checkpoint_header
+{
+  char magic[8];
+  int32_t width;
+  int32_t height;
+  int32_t passes_done;
+  int32_t samples_per_pass;
+  uint64_t seed;
+};
+
+bool save_checkpoint(const std::string &path, const render_checkpoint &state)
+{
+  checkpoint_header header;
+  std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+  header.width = state.image.width;
+  header.height = state.image.height;
+  header.passes_done = state.passes_done;
+  header.samples_per_pass = state.samples_per_pass;
+  header.seed = state.seed;
+
+  const std::string tmp_path = path + ".tmp";
+  std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+  if(!file.good())
+    {
+      std::cerr << "Cannot write checkpoint " << tmp_path << std::endl;
+      return false;
+    }
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(state.image.pixels.data()),
+             state.image.pixels.size() * sizeof(accum_pixel));
+  file.close();
+  if(!file.good())
+    {
+      std::cerr << "Failed writing checkpoint " << tmp_path << std::endl;
+      return false;
+    }
+  return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+bool load_checkpoint(const std::string &path, render_checkpoint &state)
+{
+  std::ifstream file(path, std::ios::binary);
+  if(!file.good())
+    return false;
+
+  checkpoint_header header;
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if(!file.good() || std::memcmp(header.magic, checkpoint_magic, sizeof(header.magic)) != 0
+     || header.width <= 0 || header.height <= 0)
+    {
+      std::cerr << "File " << path << " is not a checkpoint" << std::endl;
+      return false;
+    }
+
+  state.seed = header.seed;
+  state.passes_done = header.passes_done;
+  state.samples_per_pass = header.samples_per_pass;
+  state.image = framebuffer(header.width, header.height);
+  file.read(reinterpret_cast<char *>(state.image.pixels.data()),
+            state.image.pixels.size() * sizeof(accum_pixel));
+  if(!file.good())
+    {
+      std::cerr << "Checkpoint " << path << " is truncated" << std::endl;
+      return false;
+    }
+  return true;
+}
+
+static volatile std::sig_atomic_t stop_flag = 0;
+
+static void stop_handler(int signal)
+{
+  stop_flag = 1;
+  std::signal(signal, SIG_DFL);
+}
+
+void install_stop_handler()
+{
+  std::signal(SIGINT, stop_handler);
+  std::signal(SIGTERM, stop_handler);
+  std::signal(SIGUSR1, stop_handler);
+}
+
+bool stop_requested()
+{
+  return stop_flag != 0;
+}
@@ -0,0 +1,38 @@
+#ifndef CHECKPOINT_HH_INCLUDED
+#define CHECKPOINT_HH_INCLUDED
+
+#include "framebuffer.h"
+#include <cstdint>
+#include <string>
+
+// Everything needed to continue a progressive render. Sample pass p of row j
+// draws its random numbers from stream mix_seed(mix_seed(seed, p), j), so the
+// seed and the number of finished passes fully describe the RNG state.
+struct render_checkpoint
+{
+  uint64_t seed = 0;
+  int passes_done = 0;
+  int samples_per_pass = 0;
+  framebuffer image;
+};
+
+/**
+ * @brief write the checkpoint to `path`. The data goes to `path.tmp` first and
+ * is renamed over `path`, so a job killed mid-write keeps the previous checkpoint.
+ */
+bool save_checkpoint(const std::string &path, const render_checkpoint &state);
+
+/**
+ * @brief read a checkpoint written by save_checkpoint. Returns false if the file
+ * does not exist or is not a valid checkpoint.
+ */
+bool load_checkpoint(const std::string &path, render_checkpoint &state);
+
+/**
+ * @brief route SIGINT, SIGTERM and SIGUSR1 to stop_requested(). A second signal
+ * of the same kind terminates the process as usual.
+ */
+void install_stop_handler();
+bool stop_requested();
+
+#endif // CHECKPOINT_HH_INCLUDED
@@ -2,6 +2,7 @@
 
 thread_local std::uniform_real_distribution<double> distribution(0.0, 1.0);
 thread_local std::mt19937 generator;
+static thread_local uint64_t *counter = nullptr;
  
 double degrees_to_radians(double degrees)
 {
@@ -18,6 +19,14 @@ double clamp(double x, double min, double max)
 
 double random_double()
 {
+ if(counter != nullptr)
+   {
+     *counter += 0x9e3779b97f4a7c15ULL;
+     uint64_t z = *counter;
+     z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+     z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+     return ((z ^ (z >> 31)) >> 11) * 0x1.0p-53;
+   }
  return distribution(generator);
 }
 
@@ -25,3 +34,21 @@ double random_double(double min, double max)
 {
   return min + (max-min)*random_double();
 }
+
+uint64_t mix_seed(uint64_t seed, uint64_t stream)
+{
+  uint64_t z = seed + 0x9e3779b97f4a7c15ULL * (stream + 1);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+void reseed_generator(uint64_t seed)
+{
+  generator.seed(static_cast<std::mt19937::result_type>(seed ^ (seed >> 32)));
+}
+
+void use_random_counter(uint64_t *state)
+{
+  counter = state;
+}
@@ -2,6 +2,7 @@
 #define COMMON_HH_INCLUDED
 
 #include <cmath>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <random>
@@ -28,4 +29,16 @@ extern double random_double();
 
 extern double random_double(double min, double max);
 
+// Combines a seed with a stream index (splitmix64), used to derive
+// decorrelated, reproducible per-row/per-pass random streams.
+extern uint64_t mix_seed(uint64_t seed, uint64_t stream);
+
+// Restarts this thread's generator at the given stream.
+extern void reseed_generator(uint64_t seed);
+
+// Until called again with nullptr, random_double() on this thread draws from
+// the splitmix64 counter at *state and advances it. A counter costs nothing to
+// start, unlike reseeding the generator, so it suits a stream per ray.
+extern void use_random_counter(uint64_t *state);
+
 #endif // COMMON_HH_INCLUDED
@@ -0,0 +1,132 @@
+#include "denoise.h"
+#include "image_io.h"
+#include <algorithm>
+#include <iostream>
+
+bool denoise_options(const options &opts, denoiseConfig &config)
+{
+  config.enabled = opts.has("denoise");
+  config.iterations = std::max(1, opts.get_int("denoise-iterations", config.iterations));
+  config.referenceFile = opts.get("reference", "");
+  return config.enabled;
+}
+
+// B3-spline taps of the a-trous kernel
+static const double kernel[5] = {1.0 / 16, 1.0 / 4, 3.0 / 8, 1.0 / 4, 1.0 / 16};
+
+static double normal_weight(const vec3 &a, const vec3 &b, double sigma)
+{
+  // camera rays that missed carry no normal, only compare them to each other
+  bool a_miss = a.near_zero();
+  bool b_miss = b.near_zero();
+  if(a_miss || b_miss)
+    return (a_miss && b_miss) ? 1.0 : 0.0;
+  double c = dot(unit_vector(a), unit_vector(b));
+  return c <= 0 ? 0.0 : pow(c, sigma);
+}
+
+void denoise_atrous(color *image, int width, int height, int samples_per_pixel,
+                    const aux_buffer &aux, const denoiseConfig &config)
+{
+  const int num_pixels = width * height;
+  const double eps = 1e-3;
+  std::vector<color> current(num_pixels);
+  std::vector<color> next(num_pixels);
+
+#pragma omp parallel for schedule(static)
+  for(int i = 0; i < num_pixels; i++)
+    {
+      const color &a = aux.albedo[i];
+      color mean = image[i] / samples_per_pixel;
+      current[i] = color(mean.x() / std::max(a.x(), eps),
+                         mean.y() / std::max(a.y(), eps),
+                         mean.z() / std::max(a.z(), eps));
+    }
+
+  double sigma_color = config.sigmaColor;
+  for(int iteration = 0; iteration < config.iterations; iteration++)
+    {
+      const int step = 1 << iteration;
+      const double inv_color = 1.0 / (sigma_color * sigma_color);
+      const double inv_albedo = 1.0 / (config.sigmaAlbedo * config.sigmaAlbedo);
+
+#pragma omp parallel for schedule(static)
+      for(int y = 0; y < height; y++)
+        {
+          for(int x = 0; x < width; x++)
+            {
+              const int p = y * width + x;
+              const color cp = current[p];
+              const double dp = aux.depth[p];
+              color sum(0, 0, 0);
+              double weight_sum = 0;
+
+              for(int dy = -2; dy <= 2; dy++)
+                {
+                  const int qy = y + dy * step;
+                  if(qy < 0 || qy >= height)
+                    continue;
+                  for(int dx = -2; dx <= 2; dx++)
+                    {
+                      const int qx = x + dx * step;
+                      if(qx < 0 || qx >= width)
+                        continue;
+                      const int q = qy * width + qx;
+
+                      vec3 dc = current[q] - cp;
+                      vec3 da = aux.albedo[q] - aux.albedo[p];
+                      double depth_diff = fabs(aux.depth[q] - dp) / (config.sigmaDepth * std::max(dp, eps) * step);
+                      double w = kernel[dx + 2] * kernel[dy + 2]
+                        * exp(-dc.length_squared() * inv_color
+                              - da.length_squared() * inv_albedo
+                              - depth_diff)
+                        * normal_weight(aux.normal[p], aux.normal[q], config.sigmaNormal);
+
+                      sum += w * current[q];
+                      weight_sum += w;
+                    }
+                }
+              next[p] = weight_sum > 0 ? sum / weight_sum : cp;
+            }
+        }
+      current.swap(next);
+      sigma_color *= 0.5;
+    }
+
+#pragma omp parallel for schedule(static)
+  for(int i = 0; i < num_pixels; i++)
+    {
+      const color &a = aux.albedo[i];
+      image[i] = samples_per_pixel * color(current[i].x() * std::max(a.x(), eps),
+                                           current[i].y() * std::max(a.y(), eps),
+                                           current[i].z() * std::max(a.z(), eps));
+    }
+}
+
+double image_rmse(const color *image, int width, int height, int samples_per_pixel,
+                  const std::string &referenceFile)
+{
+  int ref_width = 0, ref_height = 0;
+  std::vector<unsigned char> reference;
+  if(!read_ppm(referenceFile, ref_width, ref_height, reference))
+    return -1;
+  if(ref_width != width || ref_height != height)
+    {
+      std::cerr << "Reference image is " << ref_width << "x" << ref_height
+                << ", rendered image is " << width << "x" << height << std::endl;
+      return -1;
+    }
+
+  const double scale = 1.0 / samples_per_pixel;
+  double squared_error = 0;
+#pragma omp parallel for reduction(+ : squared_error)
+  for(int i = 0; i < width * height; i++)
+    {
+      for(int c = 0; c < 3; c++)
+        {
+          double diff = to_8bit(scale * image[i][c]) - static_cast<double>(reference[3 * i + c]);
+          squared_error += diff * diff;
+        }
+    }
+  return sqrt(squared_error / (3.0 * width * height));
+}
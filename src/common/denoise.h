@@ -0,0 +1,84 @@
+#ifndef DENOISE_HH_INCLUDED
+#define DENOISE_HH_INCLUDED
+
+#include "vec3.h"
+#include "options.h"
+#include <string>
+#include <vector>
+
+// depth stored for camera rays that leave the scene
+constexpr double kMissDepth = 1e4;
+
+// Surface attributes seen by a camera ray at its first hit.
+struct first_hit
+{
+  color albedo{0, 0, 0};
+  vec3 normal{0, 0, 0};
+  double depth = 0;
+
+  first_hit &operator+=(const first_hit &other)
+  {
+    albedo += other.albedo;
+    normal += other.normal;
+    depth += other.depth;
+    return *this;
+  }
+};
+
+// Per-pixel first-hit attributes averaged over the pixel's samples.
+class aux_buffer
+{
+public:
+  aux_buffer(int w, int h)
+    : width{w}, height{h}, albedo(w * h), normal(w * h), depth(w * h, kMissDepth)
+  {}
+
+  void store(int index, const first_hit &sum, int samples)
+  {
+    albedo[index] = sum.albedo / samples;
+    normal[index] = sum.normal / samples;
+    depth[index] = sum.depth / samples;
+  }
+
+public:
+  int width;
+  int height;
+  std::vector<color> albedo;
+  std::vector<vec3> normal;
+  std::vector<double> depth;
+};
+
+struct denoiseConfig
+{
+  bool enabled = false;
+  int iterations = 4;
+  double sigmaColor = 0.35;  // radiance edge stopping, halved every iteration
+  double sigmaNormal = 64.0; // exponent on the cosine between normals
+  double sigmaDepth = 0.05;  // relative depth difference
+  double sigmaAlbedo = 0.2;
+  std::string referenceFile; // image to compute the error against, if set
+};
+
+/**
+ * @brief read --denoise, --denoise-iterations and --reference. Returns true if
+ * denoising was requested.
+ */
+bool denoise_options(const options &opts, denoiseConfig &config);
+
+/**
+ * @brief edge-avoiding a-trous wavelet filter. `image` holds per-pixel sums of
+ * samples_per_pixel samples and is filtered in place. The radiance is divided by
+ * the albedo before filtering so texture detail is kept.
+ */
+void denoise_atrous(color *image, int width, int height, int samples_per_pixel,
+                    const aux_buffer &aux, const denoiseConfig &config);
+
+/**
+ * @brief root mean square error, in 8-bit output units, between the image
+ * written for `image` and the P3/P6 image in `referenceFile`. Returns a negative
+ * value if the reference cannot be read or its size differs.
+ */
+double image_rmse(const color *image, int width, int height, int samples_per_pixel,
+                  const std::string &referenceFile);
+
+#endif // DENOISE_HH_INCLUDED
@@ -0,0 +1,51 @@
+#include "frame_writer.h"
+#include <algorithm>
+
+frame_writer::frame_writer(int max_queued)
+  : max_queued(std::max(1, max_queued)), io_thread(&frame_writer::io_loop, this)
+{}
+
+frame_writer::~frame_writer()
+{
+  finish();
+}
+
+void frame_writer::submit(const image_output &output, std::vector<color> sums, int width, int height,
+                          int samples_per_pixel)
+{
+  std::unique_lock<std::mutex> guard(lock);
+  space_free.wait(guard, [this] { return queue.size() < max_queued; });
+  queue.push_back(frame{output, std::move(sums), width, height, samples_per_pixel});
+  frame_ready.notify_one();
+}
+
+bool frame_writer::finish()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    closing = true;
+  }
+  frame_ready.notify_one();
+  if(io_thread.joinable())
+    io_thread.join();
+  return ok;
+}
+
+void frame_writer::io_loop()
+{
+  std::unique_lock<std::mutex> guard(lock);
+  while(true)
+    {
+      frame_ready.wait(guard, [this] { return closing || !queue.empty(); });
+      if(queue.empty())
+        return;
+      frame next = std::move(queue.front());
+      queue.pop_front();
+      space_free.notify_one();
+
+      guard.unlock();
+      bool written = write_image(next.output, next.sums.data(), next.width, next.height, next.samples_per_pixel);
+      guard.lock();
+      ok = ok && written;
+    }
+}
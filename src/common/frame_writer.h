@@ -0,0 +1,52 @@
+#ifndef FRAME_WRITER_HH_INCLUDED
+#define FRAME_WRITER_HH_INCLUDED
+
+#include "vec3.h"
+#include "image_io.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief output stage for a sequence of whole images. An I/O thread encodes and
+ * writes the submitted frames in order while the caller renders the next ones.
+ * submit blocks while max_queued frames are still waiting, which bounds memory.
+ */
+class frame_writer
+{
+public:
+  explicit frame_writer(int max_queued);
+  // waits for the queued frames
+  ~frame_writer();
+
+  // per-pixel sums of samples_per_pixel samples, row 0 at the top
+  void submit(const image_output &output, std::vector<color> sums, int width, int height, int samples_per_pixel);
+
+  // waits for all frames to be written; false if any write failed
+  bool finish();
+
+private:
+  struct frame
+  {
+    image_output output;
+    std::vector<color> sums;
+    int width;
+    int height;
+    int samples_per_pixel;
+  };
+
+  void io_loop();
+
+  const size_t max_queued;
+  std::mutex lock;
+  std::condition_variable frame_ready;
+  std::condition_variable space_free;
+  std::deque<frame> queue;
+  bool closing = false;
+  bool ok = true;
+  std::thread io_thread;
+};
+
+#endif // FRAME_WRITER_HH_INCLUDED
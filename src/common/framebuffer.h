@@ -0,0 +1,48 @@
+#ifndef FRAMEBUFFER_HH_INCLUDED
+#define FRAMEBUFFER_HH_INCLUDED
+
+#include "vec3.h"
+#include <vector>
+
+// Running sum of the radiance samples of one pixel, in single precision,
+// together with the number of samples folded into it.
+struct accum_pixel
+{
+  float r, g, b;
+  float samples;
+};
+
+class framebuffer
+{
+public:
+  framebuffer() : width{0}, height{0} {}
+  framebuffer(int w, int h)
+    : width{w}, height{h}, pixels(static_cast<size_t>(w) * h, accum_pixel{0, 0, 0, 0})
+  {}
+
+  void add(int index, const color &sum, int num_samples)
+  {
+    accum_pixel &p = pixels[index];
+    p.r += static_cast<float>(sum.x());
+    p.g += static_cast<float>(sum.y());
+    p.b += static_cast<float>(sum.z());
+    p.samples += num_samples;
+  }
+
+  color sum(int index) const
+  {
+    const accum_pixel &p = pixels[index];
+    return color(p.r, p.g, p.b);
+  }
+
+  int samples(int index) const { return static_cast<int>(pixels[index].samples); }
+
+  int size() const { return width * height; }
+
+public:
+  int width;
+  int height;
+  std::vector<accum_pixel> pixels;
+};
+
+#endif // FRAMEBUFFER_HH_INCLUDED
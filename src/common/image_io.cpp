@@ -0,0 +1,423 @@
+#include "image_io.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+bool parse_image_format(const std::string &name, image_format &format)
+{
+  if(name == "p3" || name == "P3")
+    format = image_format::ppm_ascii;
+  else if(name == "p6" || name == "P6" || name == "ppm")
+    format = image_format::ppm_binary;
+  else if(name == "pfm")
+    format = image_format::pfm;
+  else if(name == "qoi")
+    format = image_format::qoi;
+  else
+    return false;
+  return true;
+}
+
+bool output_options(const options &opts, image_output &output)
+{
+  output.path = opts.get("output", "");
+  std::string name = opts.get("format", "");
+  if(name.empty())
+    {
+      auto dot = output.path.rfind('.');
+      if(dot != std::string::npos)
+        parse_image_format(output.path.substr(dot + 1), output.format);
+    }
+  else if(!parse_image_format(name, output.format))
+    {
+      std::cerr << "Unknown image format " << name << ", use p3, p6, pfm or qoi" << std::endl;
+      exit(1);
+    }
+  return opts.has("output") || opts.has("format");
+}
+
+image_output frame_output(const image_output &output, int frame)
+{
+  static const char *extensions[] = {"ppm", "ppm", "pfm", "qoi"};
+  char number[16];
+  snprintf(number, sizeof(number), "_%04d", frame);
+
+  image_output numbered = output;
+  if(output.path.empty() || output.path == "-")
+    {
+      numbered.path = std::string("frame") + number + "." + extensions[static_cast<int>(output.format)];
+      return numbered;
+    }
+  auto slash = output.path.rfind('/');
+  auto dot = output.path.rfind('.');
+  if(dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    numbered.path = output.path + number;
+  else
+    numbered.path = output.path.substr(0, dot) + number + output.path.substr(dot);
+  return numbered;
+}
+
+static void append(std::vector<unsigned char> &out, const std::string &text)
+{
+  out.insert(out.end(), text.begin(), text.end());
+}
+
+static std::string dimensions(int width, int height)
+{
+  return std::to_string(width) + " " + std::to_string(height) + "\n";
+}
+
+// one row of 8-bit RGB triples
+template <typename MeanFn>
+static void quantize_row(int width, MeanFn mean, unsigned char *rgb)
+{
+  for(int x = 0; x < width; x++)
+    {
+      color c = mean(x);
+      rgb[3 * x] = to_8bit(c.x());
+      rgb[3 * x + 1] = to_8bit(c.y());
+      rgb[3 * x + 2] = to_8bit(c.z());
+    }
+}
+
+// one row of linear float RGB triples
+template <typename MeanFn>
+static void float_row(int width, MeanFn mean, unsigned char *bytes)
+{
+  for(int x = 0; x < width; x++)
+    {
+      color c = mean(x);
+      float rgb[3] = {static_cast<float>(c.x()), static_cast<float>(c.y()), static_cast<float>(c.z())};
+      std::memcpy(bytes + sizeof(rgb) * x, rgb, sizeof(rgb));
+    }
+}
+
+template <typename MeanFn>
+static void text_row(int width, MeanFn mean, std::string &row)
+{
+  row.reserve(row.size() + width * 12);
+  char pixel[16];
+  for(int x = 0; x < width; x++)
+    {
+      color c = mean(x);
+      int n = snprintf(pixel, sizeof(pixel), "%d %d %d\n", to_8bit(c.x()), to_8bit(c.y()), to_8bit(c.z()));
+      row.append(pixel, n);
+    }
+}
+
+static void put_u32_be(std::vector<unsigned char> &out, uint32_t v)
+{
+  out.push_back(v >> 24);
+  out.push_back(v >> 16);
+  out.push_back(v >> 8);
+  out.push_back(v);
+}
+
+row_encoder::row_encoder(image_format format, int width, int height)
+  : format{format}, width{width}, height{height}
+{
+  std::memset(qoi.index, 0, sizeof(qoi.index));
+  std::memset(qoi.index_used, 0, sizeof(qoi.index_used));
+  std::memset(qoi.prev, 0, sizeof(qoi.prev));
+}
+
+std::vector<unsigned char> row_encoder::header() const
+{
+  std::vector<unsigned char> out;
+  switch(format)
+    {
+    case image_format::ppm_ascii:
+      append(out, "P3\n" + dimensions(width, height) + "255\n");
+      break;
+    case image_format::pfm:
+      // negative scale: little endian samples
+      append(out, "PF\n" + dimensions(width, height) + "-1.0\n");
+      break;
+    case image_format::qoi:
+      append(out, "qoif");
+      put_u32_be(out, width);
+      put_u32_be(out, height);
+      out.push_back(3); // channels
+      out.push_back(0); // sRGB
+      break;
+    case image_format::ppm_binary:
+    default:
+      append(out, "P6\n" + dimensions(width, height) + "255\n");
+      break;
+    }
+  return out;
+}
+
+size_t row_encoder::row_size() const
+{
+  switch(format)
+    {
+    case image_format::ppm_binary:
+      return 3 * static_cast<size_t>(width);
+    case image_format::pfm:
+      return 3 * sizeof(float) * static_cast<size_t>(width);
+    default:
+      return 0;
+    }
+}
+
+int row_encoder::file_row(int y) const
+{
+  // PFM stores the bottom row first
+  return format == image_format::pfm ? height - 1 - y : y;
+}
+
+void row_encoder::encode_row(const color *sums, int samples_per_pixel, unsigned char *out) const
+{
+  const double scale = 1.0 / samples_per_pixel;
+  auto mean = [=](int x) { return scale * sums[x]; };
+  if(format == image_format::pfm)
+    float_row(width, mean, out);
+  else
+    quantize_row(width, mean, out);
+}
+
+void row_encoder::encode_row(const color *sums, int samples_per_pixel, std::vector<unsigned char> &out)
+{
+  const double scale = 1.0 / samples_per_pixel;
+  auto mean = [=](int x) { return scale * sums[x]; };
+  if(format == image_format::ppm_ascii)
+    {
+      std::string row;
+      text_row(width, mean, row);
+      append(out, row);
+    }
+  else if(format == image_format::qoi)
+    {
+      std::vector<unsigned char> rgb(3 * static_cast<size_t>(width));
+      quantize_row(width, mean, rgb.data());
+      encode_qoi(rgb.data(), width, out);
+    }
+  else
+    {
+      size_t offset = out.size();
+      out.resize(offset + row_size());
+      encode_row(sums, samples_per_pixel, out.data() + offset);
+    }
+}
+
+std::vector<unsigned char> row_encoder::trailer()
+{
+  std::vector<unsigned char> out;
+  if(format == image_format::qoi)
+    {
+      if(qoi.run > 0)
+        out.push_back(0xc0 | (qoi.run - 1));
+      qoi.run = 0;
+      static const unsigned char end_marker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+      out.insert(out.end(), end_marker, end_marker + 8);
+    }
+  return out;
+}
+
+// QOI, see https://qoiformat.org/qoi-specification.pdf. Runs may continue
+// across rows, the last one is closed by trailer().
+void row_encoder::encode_qoi(const unsigned char *rgb, int num_pixels, std::vector<unsigned char> &out)
+{
+  for(int i = 0; i < num_pixels; i++)
+    {
+      const unsigned char *px = &rgb[3 * i];
+      if(px[0] == qoi.prev[0] && px[1] == qoi.prev[1] && px[2] == qoi.prev[2])
+        {
+          if(++qoi.run == 62)
+            {
+              out.push_back(0xc0 | (qoi.run - 1));
+              qoi.run = 0;
+            }
+          continue;
+        }
+      if(qoi.run > 0)
+        {
+          out.push_back(0xc0 | (qoi.run - 1));
+          qoi.run = 0;
+        }
+
+      int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + 255 * 11) % 64;
+      if(qoi.index_used[hash] && std::memcmp(qoi.index[hash], px, 3) == 0)
+        {
+          out.push_back(hash);
+        }
+      else
+        {
+          std::memcpy(qoi.index[hash], px, 3);
+          qoi.index_used[hash] = true;
+
+          int dr = static_cast<signed char>(px[0] - qoi.prev[0]);
+          int dg = static_cast<signed char>(px[1] - qoi.prev[1]);
+          int db = static_cast<signed char>(px[2] - qoi.prev[2]);
+          int dr_dg = dr - dg;
+          int db_dg = db - dg;
+          if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+            {
+              out.push_back(0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+            }
+          else if(dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7)
+            {
+              out.push_back(0x80 | (dg + 32));
+              out.push_back(((dr_dg + 8) << 4) | (db_dg + 8));
+            }
+          else
+            {
+              out.push_back(0xfe);
+              out.insert(out.end(), px, px + 3);
+            }
+        }
+      std::memcpy(qoi.prev, px, 3);
+    }
+}
+
+// encodes the whole image, rows in parallel; mean(i) is the averaged pixel i
+template <typename MeanFn>
+static std::vector<unsigned char> encode(image_format format, int width, int height, MeanFn mean)
+{
+  row_encoder encoder(format, width, height);
+  std::vector<unsigned char> out = encoder.header();
+  const size_t header = out.size();
+
+  if(format == image_format::ppm_ascii)
+    {
+      std::vector<std::string> rows(height);
+#pragma omp parallel for schedule(static)
+      for(int y = 0; y < height; y++)
+        text_row(width, [&](int x) { return mean(y * width + x); }, rows[y]);
+      for(const auto &row : rows)
+        append(out, row);
+      return out;
+    }
+
+  const size_t row_size = encoder.row_size();
+  std::vector<unsigned char> rgb;
+  unsigned char *rows = nullptr;
+  if(row_size > 0)
+    {
+      out.resize(header + row_size * height);
+      rows = out.data() + header;
+    }
+  else
+    {
+      // QOI: quantize in parallel, then a single encoding pass
+      rgb.resize(3 * static_cast<size_t>(width) * height);
+      rows = rgb.data();
+    }
+  const size_t stride = row_size > 0 ? row_size : 3 * static_cast<size_t>(width);
+
+#pragma omp parallel for schedule(static)
+  for(int y = 0; y < height; y++)
+    {
+      auto row_mean = [&](int x) { return mean(y * width + x); };
+      unsigned char *row = rows + stride * encoder.file_row(y);
+      if(format == image_format::pfm)
+        float_row(width, row_mean, row);
+      else
+        quantize_row(width, row_mean, row);
+    }
+
+  if(format == image_format::qoi)
+    {
+      out.reserve(header + 4 * rgb.size() / 3 + 8);
+      encoder.encode_qoi(rgb.data(), width * height, out);
+      std::vector<unsigned char> end = encoder.trailer();
+      out.insert(out.end(), end.begin(), end.end());
+    }
+  return out;
+}
+
+std::vector<unsigned char> encode_image(image_format format, const color *sums, int width, int height, int samples_per_pixel)
+{
+  const double scale = 1.0 / samples_per_pixel;
+  return encode(format, width, height, [=](int i) { return scale * sums[i]; });
+}
+
+std::vector<unsigned char> encode_image(image_format format, const framebuffer &image)
+{
+  return encode(format, image.width, image.height,
+                [&](int i) { return image.sum(i) / std::max(1, image.samples(i)); });
+}
+
+bool write_bytes(const image_output &output, const std::vector<unsigned char> &bytes)
+{
+  if(output.path.empty() || output.path == "-")
+    {
+      std::cout.flush();
+      bool ok = fwrite(bytes.data(), 1, bytes.size(), stdout) == bytes.size();
+      fflush(stdout);
+      return ok;
+    }
+
+  FILE *file = fopen(output.path.c_str(), "wb");
+  if(file == nullptr)
+    {
+      std::cerr << "Cannot open " << output.path << " for writing" << std::endl;
+      return false;
+    }
+  bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+  ok = (fclose(file) == 0) && ok;
+  if(!ok)
+    std::cerr << "Failed writing " << output.path << std::endl;
+  return ok;
+}
+
+bool write_image(const image_output &output, const color *sums, int width, int height, int samples_per_pixel)
+{
+  return write_bytes(output, encode_image(output.format, sums, width, height, samples_per_pixel));
+}
+
+bool write_image(const image_output &output, const framebuffer &image)
+{
+  return write_bytes(output, encode_image(output.format, image));
+}
+
+static bool read_header_value(std::istream &in, int &value)
+{
+  in >> std::ws;
+  while(in.peek() == '#')
+    {
+      std::string comment;
+      std::getline(in, comment);
+      in >> std::ws;
+    }
+  return static_cast<bool>(in >> value);
+}
+
+bool read_ppm(const std::string &path, int &width, int &height, std::vector<unsigned char> &rgb)
+{
+  std::ifstream file(path, std::ios::binary);
+  std::string magic;
+  int max_value = 0;
+  if(!file.good() || !(file >> magic) || (magic != "P3" && magic != "P6")
+     || !read_header_value(file, width) || !read_header_value(file, height)
+     || !read_header_value(file, max_value) || max_value != 255 || width <= 0 || height <= 0)
+    {
+      std::cerr << "Cannot read P3/P6 image " << path << std::endl;
+      return false;
+    }
+
+  rgb.resize(3 * static_cast<size_t>(width) * height);
+  if(magic == "P6")
+    {
+      file.get(); // single whitespace after the header
+      file.read(reinterpret_cast<char *>(rgb.data()), rgb.size());
+    }
+  else
+    {
+      for(auto &channel : rgb)
+        {
+          int value = 0;
+          file >> value;
+          channel = static_cast<unsigned char>(value);
+        }
+    }
+  if(file.fail())
+    {
+      std::cerr << "Image " << path << " is truncated" << std::endl;
+      return false;
+    }
+  return true;
+}
@@ -0,0 +1,111 @@
+#ifndef IMAGE_IO_HH_INCLUDED
+#define IMAGE_IO_HH_INCLUDED
+
+#include "vec3.h"
+#include "framebuffer.h"
+#include "options.h"
+#include <string>
+#include <vector>
+
+enum class image_format
+{
+  ppm_ascii,  // P3, the original text output
+  ppm_binary, // P6
+  pfm,        // linear 32-bit float RGB, before tone mapping
+  qoi         // "Quite OK Image" lossless compression
+};
+
+struct image_output
+{
+  image_format format = image_format::ppm_binary;
+  std::string path; // standard output when empty or "-"
+};
+
+// the format named p3, p6 (or ppm), pfm or qoi; false for any other name
+bool parse_image_format(const std::string &name, image_format &format);
+
+/**
+ * @brief read --format=p3|p6|pfm|qoi and --output=path. Without --format the
+ * format follows the extension of the output path. Returns true if either
+ * option was given.
+ */
+bool output_options(const options &opts, image_output &output);
+
+// gamma 2 tone mapping and quantization of one averaged channel, as done by write_color
+inline unsigned char to_8bit(double mean)
+{
+  return static_cast<unsigned char>(256 * clamp(sqrt(mean), 0.0, 0.999));
+}
+
+/**
+ * @brief encode per-pixel sums of samples_per_pixel samples (row 0 at the top)
+ * into one buffer, tone mapping in parallel, and write it with a single write.
+ */
+bool write_image(const image_output &output, const color *sums, int width, int height, int samples_per_pixel);
+
+/**
+ * @brief same for an accumulation buffer, each pixel averaged over its own sample count
+ */
+bool write_image(const image_output &output, const framebuffer &image);
+
+/**
+ * @brief encode into memory instead of writing. The encoders behind write_image.
+ */
+std::vector<unsigned char> encode_image(image_format format, const color *sums, int width, int height, int samples_per_pixel);
+std::vector<unsigned char> encode_image(image_format format, const framebuffer &image);
+
+/**
+ * @brief the output of frame `frame` of an animation: the frame number, four
+ * digits, goes before the extension of output.path, or makes up frame_NNNN with
+ * the extension of the format when writing to standard output.
+ */
+image_output frame_output(const image_output &output, int frame);
+
+/**
+ * @brief write bytes to the path of `output` (or standard output) in one call
+ */
+bool write_bytes(const image_output &output, const std::vector<unsigned char> &bytes);
+
+/**
+ * @brief incremental encoder for writing an image row by row. Rows of P6 and
+ * PFM have a fixed size and can be encoded independently into place; P3 and QOI
+ * rows have variable length and QOI rows must be given top to bottom.
+ */
+class row_encoder
+{
+public:
+  row_encoder(image_format format, int width, int height);
+
+  std::vector<unsigned char> header() const;
+  // bytes of one encoded row, 0 if rows have variable length
+  size_t row_size() const;
+  // position of image row y (0 at the top) in the file
+  int file_row(int y) const;
+  // encode a row of per-pixel sums into row_size() bytes, fixed size formats only
+  void encode_row(const color *sums, int samples_per_pixel, unsigned char *out) const;
+  // append an encoded row to out
+  void encode_row(const color *sums, int samples_per_pixel, std::vector<unsigned char> &out);
+  // bytes following the last row
+  std::vector<unsigned char> trailer();
+
+  void encode_qoi(const unsigned char *rgb, int num_pixels, std::vector<unsigned char> &out);
+
+private:
+  image_format format;
+  int width;
+  int height;
+  struct
+  {
+    unsigned char index[64][3];
+    bool index_used[64];
+    unsigned char prev[3];
+    int run = 0;
+  } qoi;
+};
+
+/**
+ * @brief read a P3 or P6 image into 8-bit RGB triples, top row first
+ */
+bool read_ppm(const std::string &path, int &width, int &height, std::vector<unsigned char> &rgb);
+
+#endif // IMAGE_IO_HH_INCLUDED
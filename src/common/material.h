@@ -14,6 +14,8 @@ public:
                        const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
                        ) const = 0;
 
+  // reflectance used as a denoising feature
+  virtual color surface_albedo() const { return color(1.0, 1.0, 1.0); }
 };
 
 class lambertian : public material
@@ -35,6 +37,8 @@ public:
     return true;
   }
 
+  virtual color surface_albedo() const override { return albedo; }
+
 public:
   color albedo;
 };
@@ -56,6 +60,8 @@ public:
     return (dot(scattered.direction(), rec.normal) > 0);
   }
 
+  virtual color surface_albedo() const override { return albedo; }
+
 public:
   color albedo;
   double fuzz;
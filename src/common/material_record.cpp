@@ -0,0 +1,43 @@
+#include "material_record.h"
+#include <cstring>
+
+material_record describe_material(const material *m)
+{
+  material_record output;
+  std::memset(&output, 0, sizeof(output));
+  color albedo(0, 0, 0);
+  if(auto p = dynamic_cast<const metal *>(m))
+    {
+      output.type = material_metal;
+      albedo = p->albedo;
+      output.parameter = p->fuzz;
+    }
+  else if(auto p = dynamic_cast<const lambertian *>(m))
+    {
+      output.type = material_lambertian;
+      albedo = p->albedo;
+    }
+  else if(auto p = dynamic_cast<const dielectric *>(m))
+    {
+      output.type = material_dielectric;
+      output.parameter = p->ir;
+    }
+  for(int c = 0; c < 3; c++)
+    output.albedo[c] = albedo[c];
+  return output;
+}
+
+material *make_material(const material_record &record)
+{
+  color albedo(record.albedo[0], record.albedo[1], record.albedo[2]);
+  switch(record.type)
+    {
+    case material_metal:
+      return new metal(albedo, record.parameter);
+    case material_dielectric:
+      return new dielectric(record.parameter);
+    case material_lambertian:
+    default:
+      return new lambertian(albedo);
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef MATERIAL_RECORD_HH_INCLUDED
+#define MATERIAL_RECORD_HH_INCLUDED
+
+#include <cstdint>
+#include "material.h"
+
+enum material_kind : uint32_t
+{
+  material_lambertian = 0,
+  material_metal = 1,
+  material_dielectric = 2
+};
+
+// Plain, pointer free description of a material, used where materials are
+// stored in files or buffers shared between processes.
+struct material_record
+{
+  uint32_t type; // material_kind
+  uint32_t reserved;
+  double albedo[3];
+  double parameter; // fuzz of metal, refraction index of dielectric
+};
+
+material_record describe_material(const material *m);
+
+// allocates the material a record describes
+material *make_material(const material_record &record);
+
+#endif // MATERIAL_RECORD_HH_INCLUDED
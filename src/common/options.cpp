@@ -0,0 +1,50 @@
+#include "options.h"
+#include <cstdlib>
+
+options::options(int argc, char **argv)
+{
+  for(int i = 1; i < argc; i++)
+    {
+      std::string arg = argv[i];
+      if(arg.compare(0, 2, "--") != 0)
+        {
+          args.push_back(arg);
+          continue;
+        }
+
+      auto eq = arg.find('=');
+      if(eq == std::string::npos)
+        named[arg.substr(2)] = "";
+      else
+        named[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+    }
+}
+
+bool options::has(const std::string &name) const
+{
+  return named.count(name) != 0;
+}
+
+std::string options::get(const std::string &name, const std::string &fallback) const
+{
+  auto it = named.find(name);
+  if(it == named.end() || it->second.empty())
+    return fallback;
+  return it->second;
+}
+
+int options::get_int(const std::string &name, int fallback) const
+{
+  auto it = named.find(name);
+  if(it == named.end() || it->second.empty())
+    return fallback;
+  return std::atoi(it->second.c_str());
+}
+
+double options::get_double(const std::string &name, double fallback) const
+{
+  auto it = named.find(name);
+  if(it == named.end() || it->second.empty())
+    return fallback;
+  return std::atof(it->second.c_str());
+}
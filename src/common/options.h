@@ -0,0 +1,28 @@
+#ifndef OPTIONS_HH_INCLUDED
+#define OPTIONS_HH_INCLUDED
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Command line of the form `prog positional... --name=value --flag`.
+// Positional arguments keep their relative order so existing
+// `prog sceneFile num_threads` invocations work unchanged.
+class options
+{
+public:
+  options(int argc, char **argv);
+
+  bool has(const std::string &name) const;
+  std::string get(const std::string &name, const std::string &fallback) const;
+  int get_int(const std::string &name, int fallback) const;
+  double get_double(const std::string &name, double fallback) const;
+
+  const std::vector<std::string> &positional() const { return args; }
+
+private:
+  std::map<std::string, std::string> named;
+  std::vector<std::string> args;
+};
+
+#endif // OPTIONS_HH_INCLUDED
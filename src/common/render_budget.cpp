@@ -0,0 +1,72 @@
+#include "render_budget.h"
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+// predicted costs are scaled by this before they are compared with the time left
+static const double safety_margin = 1.2;
+
+render_budget::render_budget(double seconds) : start(omp_get_wtime()), seconds(seconds) {}
+
+void render_budget::reserve_output(const image_output &output, int width, int height)
+{
+  // encoding dominates and does not depend on the pixel values; writing is allowed as long again,
+  // and a little of the budget is kept for scheduling noise
+  framebuffer blank(width, height);
+  double tstart = omp_get_wtime();
+  encode_image(output.format, blank);
+  std::lock_guard<std::mutex> guard(lock);
+  this->output = 2 * (omp_get_wtime() - tstart) + 0.02 * seconds;
+}
+
+void render_budget::record(double seconds, double pixel_samples)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  recorded_seconds += seconds;
+  recorded_samples += pixel_samples;
+}
+
+double render_budget::remaining() const
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return start + seconds - output - omp_get_wtime();
+}
+
+bool render_budget::fits(double pixel_samples) const
+{
+  const double left = remaining();
+  std::lock_guard<std::mutex> guard(lock);
+  if(recorded_samples <= 0)
+    return left > 0;
+  return pixel_samples * recorded_seconds / recorded_samples * safety_margin <= left;
+}
+
+int render_budget::samples_that_fit(double pixels, int wanted) const
+{
+  const double left = remaining();
+  std::lock_guard<std::mutex> guard(lock);
+  if(left <= 0)
+    return 0;
+  if(recorded_samples <= 0)
+    return wanted;
+  double per_pixel_sample = recorded_seconds / recorded_samples * safety_margin;
+  double affordable = std::floor(left / (per_pixel_sample * pixels));
+  return static_cast<int>(std::min<double>(wanted, std::max(0.0, affordable)));
+}
+
+std::string samples_summary(const framebuffer &image)
+{
+  int least = image.size() > 0 ? image.samples(0) : 0;
+  int most = least;
+  double total = 0;
+  for(int i = 0; i < image.size(); i++)
+    {
+      least = std::min(least, image.samples(i));
+      most = std::max(most, image.samples(i));
+      total += image.samples(i);
+    }
+  std::ostringstream summary;
+  summary << least << " " << (image.size() > 0 ? total / image.size() : 0) << " " << most;
+  return summary.str();
+}
@@ -0,0 +1,48 @@
+#ifndef RENDER_BUDGET_HH_INCLUDED
+#define RENDER_BUDGET_HH_INCLUDED
+
+#include "framebuffer.h"
+#include "image_io.h"
+#include <mutex>
+#include <string>
+
+/**
+ * @brief wall clock budget of a render that has to finish by a deadline.
+ *
+ * The cost of a pixel sample is measured from the work recorded so far, and the
+ * time to write the image is held back, so work is only started if it is
+ * expected to end before the output has to begin. Predictions carry a safety
+ * margin. Safe to use from several threads.
+ */
+class render_budget
+{
+public:
+  // the budget runs for `seconds` from now
+  explicit render_budget(double seconds);
+
+  // holds back the time encoding and writing `output` takes, measured on a blank image of this size
+  void reserve_output(const image_output &output, int width, int height);
+
+  // `seconds` of work rendered `pixel_samples` samples
+  void record(double seconds, double pixel_samples);
+
+  // seconds left before the output has to start
+  double remaining() const;
+  // whether `pixel_samples` more samples would end in time, true as long as nothing was recorded
+  bool fits(double pixel_samples) const;
+  // samples per pixel for `pixels` pixels that end in time, at most `wanted` and 0 if none
+  int samples_that_fit(double pixels, int wanted) const;
+
+private:
+  const double start;
+  const double seconds;
+  double output = 0;
+  mutable std::mutex lock;
+  double recorded_seconds = 0;
+  double recorded_samples = 0;
+};
+
+// `min mean max` of the samples of the pixels of image
+std::string samples_summary(const framebuffer &image);
+
+#endif // RENDER_BUDGET_HH_INCLUDED
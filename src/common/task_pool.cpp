@@ -0,0 +1,116 @@
+#include "task_pool.h"
+#include <algorithm>
+#include <random>
+
+// the pool and queue index of the worker running on this thread
+static thread_local const task_pool *current_pool = nullptr;
+static thread_local int current_worker = -1;
+
+void work_deque::push(task t)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  tasks.push_back(std::move(t));
+}
+
+bool work_deque::pop(task &t)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  if(tasks.empty())
+    return false;
+  t = std::move(tasks.back());
+  tasks.pop_back();
+  return true;
+}
+
+bool work_deque::steal(task &t)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  if(tasks.empty())
+    return false;
+  t = std::move(tasks.front());
+  tasks.pop_front();
+  return true;
+}
+
+task_pool::task_pool(int num_threads)
+{
+  num_threads = std::max(1, num_threads);
+  for(int i = 0; i < num_threads; i++)
+    queues.emplace_back(new work_deque());
+  for(int i = 0; i < num_threads; i++)
+    workers.emplace_back(&task_pool::worker_loop, this, i);
+}
+
+task_pool::~task_pool()
+{
+  wait_idle();
+  {
+    std::lock_guard<std::mutex> guard(sleep_lock);
+    stopping = true;
+  }
+  task_ready.notify_all();
+  for(auto &w : workers)
+    w.join();
+}
+
+void task_pool::submit(task t)
+{
+  int index = current_pool == this ? current_worker : static_cast<int>(next_queue++ % queues.size());
+  unfinished++;
+  {
+    // taken so that a worker about to sleep cannot miss the task; counted
+    // before it is queued so that a worker taking it never sees waiting wrap
+    std::lock_guard<std::mutex> guard(sleep_lock);
+    waiting++;
+  }
+  queues[index]->push(std::move(t));
+  task_ready.notify_one();
+}
+
+void task_pool::wait_idle()
+{
+  std::unique_lock<std::mutex> guard(sleep_lock);
+  all_done.wait(guard, [this] { return unfinished == 0; });
+}
+
+bool task_pool::next_task(int index, task &t)
+{
+  if(queues[index]->pop(t))
+    return true;
+  static thread_local std::minstd_rand generator(std::random_device{}());
+  const int n = size();
+  const int first = std::uniform_int_distribution<int>(0, n - 1)(generator);
+  for(int i = 0; i < n; i++)
+    {
+      int victim = (first + i) % n;
+      if(victim != index && queues[victim]->steal(t))
+        return true;
+    }
+  return false;
+}
+
+void task_pool::worker_loop(int index)
+{
+  current_pool = this;
+  current_worker = index;
+  for(;;)
+    {
+      task t;
+      if(next_task(index, t))
+        {
+          waiting--;
+          t();
+          if(--unfinished == 0)
+            {
+              std::lock_guard<std::mutex> guard(sleep_lock);
+              all_done.notify_all();
+            }
+          continue;
+        }
+
+      std::unique_lock<std::mutex> guard(sleep_lock);
+      task_ready.wait(guard, [this] { return stopping || waiting > 0; });
+      if(stopping && waiting == 0)
+        return;
+    }
+}
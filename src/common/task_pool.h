@@ -0,0 +1,71 @@
+#ifndef TASK_POOL_HH_INCLUDED
+#define TASK_POOL_HH_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Double-ended task queue of one worker. The owner pushes and pops at the back,
+// other workers steal the oldest task from the front.
+class work_deque
+{
+public:
+  typedef std::function<void()> task;
+
+  void push(task t);
+  // false if the queue is empty
+  bool pop(task &t);
+  bool steal(task &t);
+
+private:
+  std::mutex lock;
+  std::deque<task> tasks;
+};
+
+/**
+ * @brief fixed set of worker threads with one work_deque each.
+ *
+ * A task submitted from a worker goes onto that worker's queue, from any other
+ * thread onto the queues in turn. A worker runs its own newest task first and,
+ * once its queue is empty, steals from the others starting at a random one, so
+ * no worker idles while any task is queued. Tasks may submit more tasks.
+ */
+class task_pool
+{
+public:
+  typedef work_deque::task task;
+
+  explicit task_pool(int num_threads);
+  // waits for the queued tasks and joins the workers
+  ~task_pool();
+
+  void submit(task t);
+  // blocks until every submitted task, and those they submitted, has run
+  void wait_idle();
+
+  int size() const { return static_cast<int>(queues.size()); }
+  // tasks submitted but not started yet
+  size_t queued() const { return waiting; }
+
+private:
+  void worker_loop(int index);
+  bool next_task(int index, task &t);
+
+  std::vector<std::unique_ptr<work_deque>> queues;
+  std::vector<std::thread> workers;
+  std::atomic<size_t> waiting{0};
+  std::atomic<size_t> unfinished{0};
+  std::atomic<unsigned> next_queue{0};
+
+  std::mutex sleep_lock;
+  std::condition_variable task_ready;
+  std::condition_variable all_done;
+  bool stopping = false;
+};
+
+#endif // TASK_POOL_HH_INCLUDED
@@ -0,0 +1,180 @@
+#include "tile_writer.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static bool to_stdout(const image_output &output)
+{
+  return output.path.empty() || output.path == "-";
+}
+
+bool tile_writer::supports(const image_output &output)
+{
+  // PFM stores the bottom row first, a pipe would need the whole image
+  return !(output.format == image_format::pfm && to_stdout(output));
+}
+
+tile_writer::tile_writer(const image_output &output, int width, int height, int samples_per_pixel,
+                         int rows_in_flight)
+  : width{width}, height{height}, samples_per_pixel{samples_per_pixel},
+    rows_in_flight{std::max(1, rows_in_flight)}, encoder(output.format, width, height), output{output},
+    written(height, false)
+{
+  std::vector<unsigned char> header = encoder.header();
+  header_size = header.size();
+
+  if(encoder.row_size() > 0 && !to_stdout(output))
+    {
+      mapping_size = header_size + encoder.row_size() * height;
+      fd = open(output.path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if(fd >= 0 && ftruncate(fd, mapping_size) == 0)
+        {
+          void *addr = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+          if(addr != MAP_FAILED)
+            mapping = static_cast<unsigned char *>(addr);
+        }
+      if(mapping == nullptr && fd >= 0)
+        {
+          close(fd);
+          fd = -1;
+        }
+    }
+
+  if(mapping != nullptr)
+    {
+      std::memcpy(mapping, header.data(), header_size);
+    }
+  else
+    {
+      // sequential output, also the fallback when the file cannot be mapped
+      if(to_stdout(output))
+        {
+          std::cout.flush();
+          file = stdout;
+        }
+      else
+        {
+          file = fopen(output.path.c_str(), "wb");
+        }
+      if(file == nullptr)
+        {
+          std::cerr << "Cannot open " << output.path << " for writing" << std::endl;
+          exit(1);
+        }
+      ok = fwrite(header.data(), 1, header.size(), file) == header.size();
+    }
+
+  io_thread = std::thread(&tile_writer::io_loop, this);
+}
+
+tile_writer::~tile_writer()
+{
+  if(io_thread.joinable())
+    finish();
+}
+
+void tile_writer::submit_tile(int x0, int y0, int w, int h, const color *tile, int stride)
+{
+  std::unique_lock<std::mutex> guard(lock);
+  space_free.wait(guard, [&] { return y0 < written_prefix + rows_in_flight; });
+
+  bool ready = false;
+  for(int r = 0; r < h; r++)
+    {
+      const int y = y0 + r;
+      pending_row &row = assembling[y];
+      if(row.sums.empty())
+        row.sums.resize(width);
+      std::copy(tile + r * stride, tile + r * stride + w, row.sums.begin() + x0);
+      row.filled += w;
+      if(row.filled >= width)
+        {
+          complete[y] = std::move(row.sums);
+          assembling.erase(y);
+          ready = true;
+        }
+    }
+  if(ready)
+    rows_ready.notify_one();
+}
+
+void tile_writer::io_loop()
+{
+  std::unique_lock<std::mutex> guard(lock);
+  while(true)
+    {
+      // a mapped file takes rows in any order, sequential output the next one only
+      auto next = mapping != nullptr ? complete.begin() : complete.find(written_prefix);
+      if(next == complete.end())
+        {
+          if(closing)
+            break;
+          rows_ready.wait(guard);
+          continue;
+        }
+      const int y = next->first;
+      std::vector<color> sums = std::move(next->second);
+      complete.erase(next);
+
+      guard.unlock();
+      write_row(y, sums);
+      guard.lock();
+
+      written[y] = true;
+      while(written_prefix < height && written[written_prefix])
+        written_prefix++;
+      space_free.notify_all();
+    }
+}
+
+void tile_writer::write_row(int y, const std::vector<color> &sums)
+{
+  if(mapping != nullptr)
+    {
+      size_t offset = header_size + encoder.row_size() * encoder.file_row(y);
+      encoder.encode_row(sums.data(), samples_per_pixel, mapping + offset);
+      return;
+    }
+  std::vector<unsigned char> bytes;
+  encoder.encode_row(sums.data(), samples_per_pixel, bytes);
+  if(ok)
+    ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+}
+
+bool tile_writer::finish()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    closing = true;
+  }
+  rows_ready.notify_one();
+  io_thread.join();
+
+  if(written_prefix < height)
+    {
+      std::cerr << "Image output incomplete, " << written_prefix << " of " << height << " rows written" << std::endl;
+      ok = false;
+    }
+
+  if(mapping != nullptr)
+    {
+      ok = (munmap(mapping, mapping_size) == 0) && ok;
+      ok = (close(fd) == 0) && ok;
+      mapping = nullptr;
+      fd = -1;
+    }
+  else if(file != nullptr)
+    {
+      std::vector<unsigned char> trailer = encoder.trailer();
+      if(ok)
+        ok = fwrite(trailer.data(), 1, trailer.size(), file) == trailer.size();
+      ok = (file == stdout ? fflush(file) : fclose(file)) == 0 && ok;
+      file = nullptr;
+    }
+  if(!ok)
+    std::cerr << "Failed writing " << (to_stdout(output) ? "image to standard output" : output.path) << std::endl;
+  return ok;
+}
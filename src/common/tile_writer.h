@@ -0,0 +1,82 @@
+#ifndef TILE_WRITER_HH_INCLUDED
+#define TILE_WRITER_HH_INCLUDED
+
+#include "vec3.h"
+#include "image_io.h"
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief output stage that writes an image while it is being rendered.
+ *
+ * Worker threads hand in finished tiles or rows of per-pixel sums. Rows are
+ * assembled under a lock, and an I/O thread encodes and writes every completed
+ * row. P6 and PFM images written to a file go through a memory mapped file,
+ * rows in any order. Everything else (standard output, pipes, P3, QOI) is
+ * written sequentially, holding rows that arrive early until the rows before
+ * them are out.
+ *
+ * A tile starting rows_in_flight or more rows below the first unwritten row
+ * blocks in submit_tile until the output catches up, so memory is bounded by
+ * the rows in flight instead of the image size. Workers must finish rows
+ * roughly top to bottom for this not to stall them.
+ */
+class tile_writer
+{
+public:
+  tile_writer(const image_output &output, int width, int height, int samples_per_pixel, int rows_in_flight);
+  ~tile_writer();
+
+  // false if the format cannot be written incrementally to this output, i.e. PFM to a pipe
+  static bool supports(const image_output &output);
+
+  // pixels (x0..x0+w, y0..y0+h) of the image, row 0 at the top, `stride` colors apart per row
+  void submit_tile(int x0, int y0, int w, int h, const color *tile, int stride);
+  void submit_row(int y, const color *row) { submit_tile(0, y, width, 1, row, width); }
+
+  // waits for all rows to be written and closes the output; false on I/O errors
+  bool finish();
+
+private:
+  struct pending_row
+  {
+    std::vector<color> sums;
+    int filled = 0;
+  };
+
+  void io_loop();
+  void write_row(int y, const std::vector<color> &sums);
+
+  const int width;
+  const int height;
+  const int samples_per_pixel;
+  const int rows_in_flight;
+  row_encoder encoder;
+  image_output output;
+
+  std::mutex lock;
+  std::condition_variable rows_ready;
+  std::condition_variable space_free;
+  std::map<int, pending_row> assembling; // rows still missing pixels
+  std::map<int, std::vector<color>> complete; // rows waiting for the I/O thread
+  std::vector<bool> written;
+  int written_prefix = 0; // rows [0, written_prefix) are written
+  bool closing = false;
+
+  // memory mapped output
+  int fd = -1;
+  unsigned char *mapping = nullptr;
+  size_t mapping_size = 0;
+  size_t header_size = 0;
+  // sequential output
+  FILE *file = nullptr;
+  bool ok = true;
+
+  std::thread io_thread;
+};
+
+#endif // TILE_WRITER_HH_INCLUDED
@@ -0,0 +1,205 @@
+#include "wire_format.h"
+#include "image_io.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+void wire_options(const options &opts, wire_format &format)
+{
+  std::string name = opts.get("wire", wire_name(format));
+  if(name == "float")
+    format = wire_format::float32;
+  else if(name == "half")
+    format = wire_format::half;
+  else if(name == "rgbe")
+    format = wire_format::rgbe;
+  else
+    {
+      std::cerr << "Unknown wire format " << name << ", use float, half or rgbe" << std::endl;
+      exit(1);
+    }
+}
+
+const char *wire_name(wire_format format)
+{
+  switch(format)
+    {
+    case wire_format::half:
+      return "half";
+    case wire_format::rgbe:
+      return "rgbe";
+    case wire_format::float32:
+    default:
+      return "float";
+    }
+}
+
+size_t wire_pixel_size(wire_format format)
+{
+  switch(format)
+    {
+    case wire_format::half:
+      return 3 * sizeof(uint16_t);
+    case wire_format::rgbe:
+      return 4;
+    case wire_format::float32:
+    default:
+      return 3 * sizeof(float);
+    }
+}
+
+static float bits_to_float(uint32_t bits)
+{
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+static uint32_t float_to_bits(float value)
+{
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+// IEEE 754 binary16, round to nearest even
+static uint16_t float_to_half(float value)
+{
+  uint32_t bits = float_to_bits(value);
+  uint32_t sign = (bits >> 16) & 0x8000;
+  int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+
+  if(((bits >> 23) & 0xff) == 0xff)
+    return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+  if(exponent >= 31)
+    return sign | 0x7c00;
+  if(exponent <= 0)
+    {
+      // subnormal half
+      if(exponent < -10)
+        return sign;
+      mantissa |= 0x800000;
+      int shift = 14 - exponent;
+      uint32_t half_mantissa = mantissa >> shift;
+      uint32_t rest = mantissa & ((1u << shift) - 1);
+      uint32_t halfway = 1u << (shift - 1);
+      if(rest > halfway || (rest == halfway && (half_mantissa & 1)))
+        half_mantissa++;
+      return sign | half_mantissa;
+    }
+
+  uint32_t half_bits = sign | (exponent << 10) | (mantissa >> 13);
+  uint32_t rest = mantissa & 0x1fff;
+  // a carry out of the mantissa correctly bumps the exponent
+  if(rest > 0x1000 || (rest == 0x1000 && (half_bits & 1)))
+    half_bits++;
+  return half_bits;
+}
+
+static float half_to_float(uint16_t half)
+{
+  int exponent = (half >> 10) & 0x1f;
+  uint32_t mantissa = half & 0x3ff;
+  float value;
+  if(exponent == 0)
+    value = std::ldexp(static_cast<float>(mantissa), -24);
+  else if(exponent == 31)
+    value = mantissa != 0 ? std::numeric_limits<float>::quiet_NaN() : std::numeric_limits<float>::infinity();
+  else
+    value = std::ldexp(static_cast<float>(mantissa | 0x400), exponent - 25);
+  return (half & 0x8000) ? -value : value;
+}
+
+// Steps a rounded non-negative encoding to the neighbouring representable
+// value until it gives the same output byte as the original channel. Both
+// float and half bit patterns of non-negative numbers are ordered like the
+// numbers themselves.
+template <typename Bits, typename Decode>
+static Bits match_output(Bits bits, unsigned char target, double scale, Decode decode)
+{
+  for(int step = 0; step < 16; step++)
+    {
+      unsigned char got = to_8bit(scale * decode(bits));
+      if(got == target)
+        break;
+      bits = got < target ? bits + 1 : bits - 1;
+    }
+  return bits;
+}
+
+void encode_wire_pixel(wire_format format, const color &sum, int samples_per_pixel, unsigned char *out)
+{
+  const double scale = 1.0 / samples_per_pixel;
+  if(format == wire_format::float32)
+    {
+      float rgb[3];
+      for(int c = 0; c < 3; c++)
+        {
+          double channel = std::max(sum[c], 0.0);
+          uint32_t bits = float_to_bits(static_cast<float>(channel));
+          bits = match_output(bits, to_8bit(scale * channel), scale, bits_to_float);
+          rgb[c] = bits_to_float(bits);
+        }
+      std::memcpy(out, rgb, sizeof(rgb));
+    }
+  else if(format == wire_format::half)
+    {
+      uint16_t rgb[3];
+      for(int c = 0; c < 3; c++)
+        {
+          double channel = std::max(sum[c], 0.0);
+          uint16_t bits = float_to_half(static_cast<float>(channel));
+          rgb[c] = match_output(bits, to_8bit(scale * channel), scale, half_to_float);
+        }
+      std::memcpy(out, rgb, sizeof(rgb));
+    }
+  else
+    {
+      // Shared exponent of the gamma corrected, clamped mean that to_8bit
+      // quantizes. Mantissas are truncated on a grid at least as fine as the
+      // 8-bit output, so the output byte survives exactly.
+      double gamma[3];
+      for(int c = 0; c < 3; c++)
+        gamma[c] = clamp(sqrt(std::max(scale * sum[c], 0.0)), 0.0, 0.999);
+      double largest = std::max(gamma[0], std::max(gamma[1], gamma[2]));
+      if(largest < 1.0 / 256)
+        {
+          std::memset(out, 0, 4);
+          return;
+        }
+      int exponent;
+      std::frexp(largest, &exponent);
+      for(int c = 0; c < 3; c++)
+        out[c] = static_cast<unsigned char>(std::ldexp(gamma[c], 8 - exponent));
+      out[3] = static_cast<unsigned char>(exponent + 128);
+    }
+}
+
+color decode_wire_pixel(wire_format format, const unsigned char *in, int samples_per_pixel)
+{
+  if(format == wire_format::float32)
+    {
+      float rgb[3];
+      std::memcpy(rgb, in, sizeof(rgb));
+      return color(rgb[0], rgb[1], rgb[2]);
+    }
+  if(format == wire_format::half)
+    {
+      uint16_t rgb[3];
+      std::memcpy(rgb, in, sizeof(rgb));
+      return color(half_to_float(rgb[0]), half_to_float(rgb[1]), half_to_float(rgb[2]));
+    }
+
+  if(in[3] == 0)
+    return color(0, 0, 0);
+  const int exponent = static_cast<int>(in[3]) - 128;
+  color sum;
+  for(int c = 0; c < 3; c++)
+    {
+      // middle of the mantissa step, away from the output byte boundaries
+      double gamma = std::ldexp(in[c] + 0.5, exponent - 8);
+      sum[c] = samples_per_pixel * gamma * gamma;
+    }
+  return sum;
+}
@@ -0,0 +1,31 @@
+#ifndef WIRE_FORMAT_HH_INCLUDED
+#define WIRE_FORMAT_HH_INCLUDED
+
+#include "vec3.h"
+#include "options.h"
+#include <cstddef>
+
+// Encoding of a rendered pixel (the sum of its samples) sent between ranks.
+// Every encoding decodes to a pixel that gives the same 8-bit output as the
+// original, see to_8bit in image_io.h.
+enum class wire_format
+{
+  float32, // 12 bytes, linear float sums
+  half,    // 6 bytes, linear half precision sums
+  rgbe     // 4 bytes, shared exponent of the gamma corrected mean; clamps HDR values
+};
+
+/**
+ * @brief read --wire=float|half|rgbe, exits on an unknown name
+ */
+void wire_options(const options &opts, wire_format &format);
+
+const char *wire_name(wire_format format);
+
+size_t wire_pixel_size(wire_format format);
+
+void encode_wire_pixel(wire_format format, const color &sum, int samples_per_pixel, unsigned char *out);
+
+color decode_wire_pixel(wire_format format, const unsigned char *in, int samples_per_pixel);
+
+#endif // WIRE_FORMAT_HH_INCLUDED
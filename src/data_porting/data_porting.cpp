@@ -7,6 +7,9 @@
 #include <fstream>
 #include <iomanip>
 #include "boundable.h"
+#include "scene_binary.h"
+#include "json_scene_loader.h"
+#include "sphere_generation.h"
 
 using json = nlohmann::json;
 
@@ -18,8 +21,59 @@ void ShapeDataIO::clear_scene(std::vector<Sphere*> &input){
 }
 
 std::vector<Sphere*> ShapeDataIO::load_scene(std::string fileName){
-  nlohmann::json j = this->read(fileName);
-  return this->deserialize_Spheres(j);
+  std::vector<Sphere*> output;
+  std::string error;
+  if(!load_scene(fileName, output, error)){
+    std::cerr<<error<<std::endl;
+    exit(1);
+  }
+  return output;
+}
+
+bool ShapeDataIO::load_scene(const std::string &fileName, std::vector<Sphere*> &output, std::string &error){
+  if(SphereGeneration::is_spec(fileName)){
+    SceneGenerationParams params;
+    if(!SphereGeneration::parse_spec(fileName, params)){
+      error = "Invalid scene spec " + fileName;
+      return false;
+    }
+    output = SphereGeneration::generate_Spheres(params);
+    return true;
+  }
+  if(BinaryScene::isBinaryScene(fileName)){
+    BinaryScene scene;
+    if(!scene.open(fileName)){
+      error = "Cannot open binary scene " + fileName;
+      return false;
+    }
+    if(!scene.spheres(0, scene.sphereCount, output)){
+      error = "Binary scene " + fileName + " refers to a material that does not exist";
+      return false;
+    }
+    return true;
+  }
+  return JsonSceneLoader::load(fileName, output, error);
+}
+
+std::vector<Sphere*> ShapeDataIO::load_scene_part(const std::string &fileName, int part, int parts, uint64_t &total){
+  if(SphereGeneration::is_spec(fileName)){
+    SceneGenerationParams params;
+    if(!SphereGeneration::parse_spec(fileName, params)){
+      std::cerr<<"Invalid scene spec "<<fileName<<std::endl;
+      exit(1);
+    }
+    total = params.count;
+    return SphereGeneration::generate_Spheres(params, total * part / parts, total * (part + 1) / parts);
+  }
+  if(BinaryScene::isBinaryScene(fileName)){
+    BinaryScene scene;
+    if(!scene.open(fileName))
+      exit(1);
+    total = scene.sphereCount;
+    return scene.spheres(total * part / parts, total * (part + 1) / parts);
+  }
+  std::cerr<<"Scene "<<fileName<<" cannot be read in parts; convert it to a binary scene with scene_convert"<<std::endl;
+  exit(1);
 }
 
 json ShapeDataIO::serialize(const material *pMaterial){    
@@ -155,7 +209,6 @@ json ShapeDataIO::read(std::string fileName){
         std::cerr<<"File "<<fileName<<" not exist"<<std::endl;
         exit(1);
     }
-    file.open(fileName);
     //std::cout<<file.rdbuf();
     file>>j;
     file.close();
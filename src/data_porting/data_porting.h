@@ -1,6 +1,7 @@
 #ifndef _DATA_PORTING_H_
 #define _DATA_PORTING_H_
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include "sphere.h"
@@ -20,7 +21,16 @@ public:
     void write(std::string fileName, nlohmann::json &j);
 
     nlohmann::json read(std::string fileName);
+    // loads a JSON scene, a binary one (see scene_binary.h) or generates a
+    // procedural one from a gen: spec (see sphere_generation.h)
     std::vector<Sphere*> load_scene(std::string fileName);
+    // the same into output, false with error set instead of exiting when the scene
+    // cannot be read or is malformed
+    bool load_scene(const std::string &fileName, std::vector<Sphere*> &output, std::string &error);
+    // spheres [total * part / parts, total * (part + 1) / parts) of a binary scene or
+    // gen: spec, without reading the others; total is set to the scene's sphere count.
+    // Exits for JSON scenes, which cannot be read in parts.
+    std::vector<Sphere*> load_scene_part(const std::string &fileName, int part, int parts, uint64_t &total);
     void clear_scene(std::vector<Sphere*> &input);
 
     std::vector<sphere*> deserialize_spheres(const nlohmann::json &j);
@@ -2,6 +2,10 @@
 #include "data_porting.h"
 #include <nlohmann/json.hpp>
 #include "material.h"
+#include "scene_binary.h"
+#include "json_scene_loader.h"
+#include "sphere_generation.h"
+#include <cstdio>
 
 TEST(serializing, color){
     ShapeDataIO io;
@@ -84,4 +88,166 @@ TEST(deserializing, Sphere){
     ASSERT_DOUBLE_EQ(0.6, dynamic_cast<lambertian*>(parsed[0]->mat_ptr)->albedo.y());
     ASSERT_DOUBLE_EQ(0.5, dynamic_cast<lambertian*>(parsed[0]->mat_ptr)->albedo.z());
     ASSERT_DOUBLE_EQ(1000, parsed[0]->r);
-}
\ No newline at end of file
+}
+TEST(binary_scene, round_trip){
+    ShapeDataIO io;
+    std::vector<Sphere*> spheres;
+    spheres.push_back(new Sphere(vec3(0, -1000, 0), 1000, new lambertian(color(0.5, 0.5, 0.5))));
+    spheres.push_back(new Sphere(vec3(1, 2, 3), 0.2, new metal(color(0.7, 0.6, 0.5), 0.3)));
+    spheres.push_back(new Sphere(vec3(-4, 1, 0), 1, new dielectric(1.5)));
+    spheres.push_back(new Sphere(vec3(4, 1, 0), 1, new lambertian(color(0.5, 0.5, 0.5))));
+    ASSERT_TRUE(BinaryScene::write("binary_scene_test.scene", spheres));
+
+    BinaryScene scene;
+    ASSERT_TRUE(scene.open("binary_scene_test.scene"));
+    ASSERT_EQ(4u, scene.sphereCount);
+    // the two identical lambertians share a material entry
+    ASSERT_EQ(3u, scene.materialCount);
+    ASSERT_EQ(scene.materialId[0], scene.materialId[3]);
+
+    std::vector<Sphere*> loaded = io.load_scene("binary_scene_test.scene");
+    std::remove("binary_scene_test.scene");
+    ASSERT_EQ(spheres.size(), loaded.size());
+    for(size_t i = 0; i < spheres.size(); i++){
+        ASSERT_DOUBLE_EQ(spheres[i]->center.x(), loaded[i]->center.x());
+        ASSERT_DOUBLE_EQ(spheres[i]->center.y(), loaded[i]->center.y());
+        ASSERT_DOUBLE_EQ(spheres[i]->center.z(), loaded[i]->center.z());
+        ASSERT_DOUBLE_EQ(spheres[i]->r, loaded[i]->r);
+        ASSERT_EQ(io.serialize(spheres[i]->mat_ptr), io.serialize(loaded[i]->mat_ptr));
+    }
+    io.clear_scene(spheres);
+    io.clear_scene(loaded);
+}
+
+TEST(json_scene_loader, matches_dom_parse){
+    ShapeDataIO io;
+    std::vector<sphere*> spheres;
+    // large enough for the file to be split into several chunks
+    for(int i = 0; i < 12000; i++){
+        vec3 center(i % 97, i / 97, 0.25 * i);
+        if(i % 3 == 0)
+            spheres.push_back(new sphere(center, 0.2, std::make_unique<lambertian>(color(0.1, 0.2, i % 7 / 7.0))));
+        else if(i % 3 == 1)
+            spheres.push_back(new sphere(center, 0.3, std::make_unique<metal>(color(0.7, 0.6, 0.5), i % 5 / 10.0)));
+        else
+            spheres.push_back(new sphere(center, 0.4, std::make_unique<dielectric>(1.5)));
+    }
+    nlohmann::json j = io.serialize(spheres);
+    io.write("json_scene_loader_test.data", j);
+
+    std::vector<Sphere*> expected = io.deserialize_Spheres(j);
+    std::string text = j.dump();
+    std::vector<Sphere*> parsed = JsonSceneLoader::parse(text.data(), text.data() + text.size());
+    std::vector<Sphere*> chunked = JsonSceneLoader::load("json_scene_loader_test.data", 4);
+    std::remove("json_scene_loader_test.data");
+
+    for(auto loaded : {&parsed, &chunked}){
+        ASSERT_EQ(expected.size(), loaded->size());
+        for(size_t i = 0; i < expected.size(); i++){
+            Sphere *a = expected[i], *b = (*loaded)[i];
+            ASSERT_DOUBLE_EQ(a->center.x(), b->center.x());
+            ASSERT_DOUBLE_EQ(a->center.y(), b->center.y());
+            ASSERT_DOUBLE_EQ(a->center.z(), b->center.z());
+            ASSERT_DOUBLE_EQ(a->r, b->r);
+            ASSERT_EQ(io.serialize(a->mat_ptr), io.serialize(b->mat_ptr));
+        }
+    }
+    for(auto s : spheres)
+        delete s;
+    io.clear_scene(expected);
+    io.clear_scene(parsed);
+    io.clear_scene(chunked);
+}
+
+TEST(scene_generation, json_and_binary_streams_agree){
+    ShapeDataIO io;
+    SceneGenerationParams params;
+    params.count = 70000;
+    params.seed = 7;
+    for(auto distribution : {SceneDistribution::grid, SceneDistribution::random_scene, SceneDistribution::uniform,
+                             SceneDistribution::clustered, SceneDistribution::multiscale}){
+        params.distribution = distribution;
+        params.threads = 1;
+        ASSERT_TRUE(SphereGeneration::write_scene("scene_generation_test.data", params, false));
+        // the thread count does not change the scene
+        params.threads = 3;
+        ASSERT_TRUE(SphereGeneration::write_scene("scene_generation_test.scene", params, true));
+        std::vector<Sphere*> json = io.load_scene("scene_generation_test.data");
+        std::vector<Sphere*> binary = io.load_scene("scene_generation_test.scene");
+        std::remove("scene_generation_test.data");
+        std::remove("scene_generation_test.scene");
+
+        ASSERT_EQ(params.count, json.size());
+        ASSERT_EQ(params.count, binary.size());
+        for(size_t i = 0; i < json.size(); i++){
+            ASSERT_EQ(json[i]->center.x(), binary[i]->center.x());
+            ASSERT_EQ(json[i]->center.y(), binary[i]->center.y());
+            ASSERT_EQ(json[i]->center.z(), binary[i]->center.z());
+            ASSERT_EQ(json[i]->r, binary[i]->r);
+            ASSERT_EQ(io.serialize(json[i]->mat_ptr), io.serialize(binary[i]->mat_ptr));
+        }
+        io.clear_scene(json);
+        io.clear_scene(binary);
+    }
+}
+
+TEST(scene_generation, procedural_spec_matches_written_scene){
+    SceneGenerationParams params;
+    ASSERT_TRUE(SphereGeneration::parse_spec("gen:clustered,count=5000,seed=9,clusters=8,extent=20", params));
+    ASSERT_EQ(SceneDistribution::clustered, params.distribution);
+    ASSERT_EQ(5000u, params.count);
+    ASSERT_EQ(9u, params.seed);
+    ASSERT_EQ(8, params.clusters);
+    ASSERT_DOUBLE_EQ(20, params.extent);
+    SceneGenerationParams other;
+    ASSERT_TRUE(SphereGeneration::parse_spec("gen:grid,size=11", other));
+    ASSERT_EQ(484u, other.count);
+    ASSERT_TRUE(SphereGeneration::parse_spec("gen:random_scene,size=11", other));
+    ASSERT_EQ(488u, other.count);
+    for(auto invalid : {"gen:grid", "gen:spiral,count=3", "gen:grid,count=3x", "gen:grid,count=-3", "gen:grid,seed=abc", "grid,count=3"}){
+        SceneGenerationParams rejected;
+        ASSERT_FALSE(SphereGeneration::parse_spec(invalid, rejected));
+    }
+
+    ShapeDataIO io;
+    ASSERT_TRUE(SphereGeneration::write_scene("procedural_spec_test.scene", params, true));
+    std::vector<Sphere*> written = io.load_scene("procedural_spec_test.scene");
+    std::remove("procedural_spec_test.scene");
+    std::vector<Sphere*> generated = io.load_scene("gen:clustered,count=5000,seed=9,clusters=8,extent=20");
+    ASSERT_EQ(written.size(), generated.size());
+    for(size_t i = 0; i < written.size(); i++){
+        ASSERT_EQ(written[i]->center.x(), generated[i]->center.x());
+        ASSERT_EQ(written[i]->center.z(), generated[i]->center.z());
+        ASSERT_EQ(written[i]->r, generated[i]->r);
+        ASSERT_EQ(io.serialize(written[i]->mat_ptr), io.serialize(generated[i]->mat_ptr));
+    }
+    io.clear_scene(written);
+    io.clear_scene(generated);
+}
+
+TEST(scene_generation, random_scene_matches_the_layout_of_random_scene_spheres){
+    ShapeDataIO io;
+    std::vector<Sphere*> spheres = io.load_scene("gen:random_scene,size=11,seed=5");
+    ASSERT_EQ(488u, spheres.size());
+    // the ground first and the three big spheres last, with the same materials
+    SphereGeneration sg;
+    std::vector<Sphere*> reference = sg.random_scene_Spheres(1);
+    for(size_t k = 0; k < 4; k++){
+        const Sphere *fixed = k == 0 ? spheres.front() : spheres[spheres.size() - 4 + k];
+        const Sphere *expected = k == 0 ? reference.front() : reference[reference.size() - 4 + k];
+        ASSERT_EQ(expected->center.x(), fixed->center.x());
+        ASSERT_EQ(expected->center.y(), fixed->center.y());
+        ASSERT_EQ(expected->r, fixed->r);
+        ASSERT_EQ(io.serialize(expected->mat_ptr), io.serialize(fixed->mat_ptr));
+    }
+    // the grid stays in its cells and clear of the metal sphere
+    for(size_t i = 1; i + 3 < spheres.size(); i++){
+        const Sphere *s = spheres[i];
+        ASSERT_DOUBLE_EQ(0.2, s->r);
+        ASSERT_GE(s->center.x(), -11);
+        ASSERT_LT(s->center.x(), 11);
+        ASSERT_GT((s->center - point3(4, 0.2, 0)).length(), 0.9);
+    }
+    io.clear_scene(spheres);
+    io.clear_scene(reference);
+}
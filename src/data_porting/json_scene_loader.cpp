@@ -0,0 +1,338 @@
+#include "json_scene_loader.h"
+#include "material.h"
+#include <nlohmann/json.hpp>
+#include <omp.h>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+namespace
+{
+// SAX handler that creates a Sphere whenever a "sphere" object closes. It is
+// fed either a whole scene or single elements of the "spheres" array.
+class SphereBuilder
+{
+public:
+    explicit SphereBuilder(std::vector<Sphere *> &out) : output(out) {}
+
+    bool null() { return true; }
+    bool boolean(bool) { return true; }
+    bool number_integer(json::number_integer_t value) { return number(static_cast<double>(value)); }
+    bool number_unsigned(json::number_unsigned_t value) { return number(static_cast<double>(value)); }
+    bool number_float(json::number_float_t value, const json::string_t &) { return number(value); }
+    template <typename Binary>
+    bool binary(Binary &) { return true; }
+
+    bool string(json::string_t &value)
+    {
+        if (parentKey() == "material" && currentKey() == "type")
+            type = value;
+        return true;
+    }
+
+    bool start_object(std::size_t) { keys.emplace_back(); return true; }
+    bool key(json::string_t &name) { keys.back() = name; return true; }
+    bool end_object()
+    {
+        keys.pop_back();
+        if (!keys.empty() && keys.back() == "sphere")
+            return emit();
+        return true;
+    }
+    bool start_array(std::size_t) { keys.emplace_back(); return true; }
+    bool end_array() { keys.pop_back(); return true; }
+
+    template <typename Exception>
+    bool parse_error(std::size_t, const std::string &, const Exception &ex)
+    {
+        error = ex.what();
+        return false;
+    }
+
+    std::string error;
+
+private:
+    // key of the innermost open value, and of the ones enclosing it
+    const std::string &keyAt(size_t up) const
+    {
+        static const std::string none;
+        return keys.size() > up ? keys[keys.size() - 1 - up] : none;
+    }
+    const std::string &currentKey() const { return keyAt(0); }
+    const std::string &parentKey() const { return keyAt(1); }
+
+    bool number(double value)
+    {
+        const std::string &name = currentKey();
+        const std::string &parent = parentKey();
+        if (parent == "location")
+        {
+            if (name == "x") center[0] = value;
+            else if (name == "y") center[1] = value;
+            else if (name == "z") center[2] = value;
+        }
+        else if (parent == "color" && keyAt(2) == "material")
+        {
+            if (name == "r") albedo[0] = value;
+            else if (name == "g") albedo[1] = value;
+            else if (name == "b") albedo[2] = value;
+        }
+        else if (parent == "material")
+        {
+            if (name == "fuzz") fuzz = value;
+            else if (name == "refraction_index") refractionIndex = value;
+        }
+        else if (parent == "sphere" && name == "radius")
+        {
+            radius = value;
+        }
+        return true;
+    }
+
+    bool emit()
+    {
+        material *m = nullptr;
+        if (type == "lambertian")
+            m = new lambertian(albedo);
+        else if (type == "metal")
+            m = new metal(albedo, fuzz);
+        else if (type == "dielectric")
+            m = new dielectric(refractionIndex);
+        else
+        {
+            error = "Unknown material type " + type;
+            return false;
+        }
+        output.push_back(new Sphere(center, radius, m));
+        center = vec3(0, 0, 0);
+        albedo = color(0, 0, 0);
+        radius = fuzz = refractionIndex = 0;
+        type.clear();
+        return true;
+    }
+
+    std::vector<Sphere *> &output;
+    std::vector<std::string> keys;
+    vec3 center;
+    color albedo;
+    double radius = 0;
+    double fuzz = 0;
+    double refractionIndex = 0;
+    std::string type;
+};
+
+const char *skipSpace(const char *p, const char *end)
+{
+    while (p < end && std::isspace(static_cast<unsigned char>(*p)))
+        p++;
+    return p;
+}
+
+// just past the '[' of the "spheres" array, nullptr if there is none
+const char *findSpheresArray(const char *begin, const char *end)
+{
+    static const char key[] = "\"spheres\"";
+    const char *p = static_cast<const char *>(memmem(begin, end - begin, key, sizeof(key) - 1));
+    if (p == nullptr)
+        return nullptr;
+    p = skipSpace(p + sizeof(key) - 1, end);
+    if (p == end || *p != ':')
+        return nullptr;
+    p = skipSpace(p + 1, end);
+    if (p == end || *p != '[')
+        return nullptr;
+    return p + 1;
+}
+
+// The '{' of the first {"sphere": ...} element whose key lies at or after
+// `from`, found by pattern instead of by parsing; end if there is none.
+const char *findElementStart(const char *begin, const char *from, const char *end)
+{
+    static const char key[] = "\"sphere\"";
+    const char *p = from;
+    while (p < end)
+    {
+        const char *k = static_cast<const char *>(memmem(p, end - p, key, sizeof(key) - 1));
+        if (k == nullptr)
+            return end;
+        const char *after = skipSpace(k + sizeof(key) - 1, end);
+        const char *before = k;
+        while (before > begin && std::isspace(static_cast<unsigned char>(before[-1])))
+            before--;
+        if (after < end && *after == ':' && before > begin && before[-1] == '{')
+            return before - 1;
+        p = k + 1;
+    }
+    return end;
+}
+
+// past the '}' closing the object that opens at p, nullptr if it is unterminated
+const char *matchObject(const char *p, const char *end)
+{
+    int depth = 0;
+    bool inString = false;
+    for (; p < end; p++)
+    {
+        const char c = *p;
+        if (inString)
+        {
+            if (c == '\\')
+                p++;
+            else if (c == '"')
+                inString = false;
+            continue;
+        }
+        if (c == '"')
+            inString = true;
+        else if (c == '{' || c == '[')
+            depth++;
+        else if ((c == '}' || c == ']') && --depth == 0)
+            return p + 1;
+    }
+    return nullptr;
+}
+
+// Parses the array elements from start up to stop, where the next chunk begins
+// (end for the last one). False if the elements do not line up with stop, or
+// do not parse; the caller then parses the whole file sequentially.
+bool parseChunk(const char *start, const char *stop, const char *end, std::vector<Sphere *> &output)
+{
+    SphereBuilder builder(output);
+    const char *p = start;
+    while (p < stop)
+    {
+        if (*p != '{')
+            return false;
+        const char *close = matchObject(p, end);
+        if (close == nullptr || !json::sax_parse(p, close, &builder))
+            return false;
+        p = skipSpace(close, end);
+        if (p < end && *p == ',')
+            p = skipSpace(p + 1, end);
+        else if (p < end && *p == ']')
+            return stop == end;
+        else
+            return false;
+    }
+    return p == stop;
+}
+
+void freeSpheres(std::vector<Sphere *> &spheres)
+{
+    for (Sphere *s : spheres)
+        delete s;
+    spheres.clear();
+}
+} // namespace
+
+std::vector<Sphere *> JsonSceneLoader::parse(const char *begin, const char *end)
+{
+    std::vector<Sphere *> output;
+    std::string error;
+    if (!parse(begin, end, output, error))
+    {
+        std::cerr << error << std::endl;
+        exit(1);
+    }
+    return output;
+}
+
+bool JsonSceneLoader::parse(const char *begin, const char *end, std::vector<Sphere *> &output, std::string &error)
+{
+    SphereBuilder builder(output);
+    if (!json::sax_parse(begin, end, &builder))
+    {
+        error = "Cannot parse scene: " + builder.error;
+        freeSpheres(output);
+        return false;
+    }
+    return true;
+}
+
+std::vector<Sphere *> JsonSceneLoader::load(const std::string &fileName, int numThreads)
+{
+    std::vector<Sphere *> output;
+    std::string error;
+    if (!load(fileName, output, error, numThreads))
+    {
+        std::cerr << error << std::endl;
+        exit(1);
+    }
+    return output;
+}
+
+bool JsonSceneLoader::load(const std::string &fileName, std::vector<Sphere *> &output, std::string &error, int numThreads)
+{
+    int fd = open(fileName.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        error = "File " + fileName + " not exist";
+        return false;
+    }
+    const size_t size = info.st_size;
+    void *mapping = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    close(fd);
+    if (mapping == MAP_FAILED || mapping == nullptr)
+    {
+        error = "Cannot map " + fileName;
+        return false;
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    const char *begin = static_cast<const char *>(mapping);
+    const char *end = begin + size;
+
+    // chunks of at least a megabyte, a few per thread to even out the load
+    const size_t kMinChunk = 1 << 20;
+    if (numThreads <= 0)
+        numThreads = omp_get_max_threads();
+    const char *array = findSpheresArray(begin, end);
+    size_t numChunks = array == nullptr ? 1 : std::min<size_t>(4 * numThreads, (end - array) / kMinChunk);
+
+    bool parsed = false;
+    if (numChunks > 1)
+    {
+        std::vector<const char *> starts(numChunks + 1, end);
+        starts[0] = skipSpace(array, end);
+        if (starts[0] < end && *starts[0] == ']')
+            starts[0] = end;
+        for (size_t c = 1; c < numChunks; c++)
+        {
+            const char *guess = array + (end - array) * c / numChunks;
+            starts[c] = std::max(starts[c - 1], findElementStart(begin, guess, end));
+        }
+
+        std::vector<std::vector<Sphere *>> parts(numChunks);
+        std::vector<char> ok(numChunks, 0);
+#pragma omp parallel for schedule(dynamic) num_threads(numThreads)
+        for (size_t c = 0; c < numChunks; c++)
+            ok[c] = parseChunk(starts[c], starts[c + 1], end, parts[c]);
+
+        parsed = std::all_of(ok.begin(), ok.end(), [](char v) { return v != 0; });
+        size_t total = 0;
+        for (auto &part : parts)
+            total += part.size();
+        output.reserve(parsed ? total : 0);
+        for (auto &part : parts)
+        {
+            if (parsed)
+                output.insert(output.end(), part.begin(), part.end());
+            else
+                freeSpheres(part);
+        }
+    }
+    if (!parsed)
+        parsed = parse(begin, end, output, error);
+
+    munmap(mapping, size);
+    return parsed;
+}
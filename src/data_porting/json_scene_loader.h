@@ -0,0 +1,36 @@
+#ifndef _JSON_SCENE_LOADER_H_
+#define _JSON_SCENE_LOADER_H_
+
+#include <string>
+#include <vector>
+#include "boundable.h"
+
+/**
+ * Streaming loader for JSON scenes of the form {"spheres": [{"sphere": {...}}, ...]}.
+ * Spheres are created from SAX events as their object closes, no DOM is built.
+ * The file is mapped and the "spheres" array is cut into chunks at element
+ * boundaries that are parsed in parallel.
+ */
+class JsonSceneLoader
+{
+public:
+    /**
+     * @brief load fileName using up to numThreads threads (all OpenMP threads if 0).
+     * Exits on a malformed scene.
+     */
+    static std::vector<Sphere *> load(const std::string &fileName, int numThreads = 0);
+
+    /**
+     * @brief the same into output, which is left empty, returning false with error
+     * set on an unreadable or malformed scene instead of exiting
+     */
+    static bool load(const std::string &fileName, std::vector<Sphere *> &output, std::string &error, int numThreads = 0);
+
+    /**
+     * @brief parse a scene held in memory on the calling thread
+     */
+    static std::vector<Sphere *> parse(const char *begin, const char *end);
+    static bool parse(const char *begin, const char *end, std::vector<Sphere *> &output, std::string &error);
+};
+
+#endif
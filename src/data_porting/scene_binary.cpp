@@ -0,0 +1,277 @@
+#include "scene_binary.h"
+#include "material.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+static const char kSceneMagic[8] = {'P', 'R', 'S', 'C', 'E', 'N', 'E', '\0'};
+static const uint32_t kSceneVersion = 1;
+static const uint64_t kArrayAlignment = 64;
+
+static uint64_t alignUp(uint64_t offset)
+{
+    return (offset + kArrayAlignment - 1) / kArrayAlignment * kArrayAlignment;
+}
+
+BinaryScene::~BinaryScene()
+{
+    if (mapping != nullptr)
+        munmap(mapping, mappingSize);
+}
+
+bool BinaryScene::isBinaryScene(const std::string &fileName)
+{
+    char magic[sizeof(kSceneMagic)] = {0};
+    FILE *file = fopen(fileName.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+    size_t got = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    return got == sizeof(magic) && std::memcmp(magic, kSceneMagic, sizeof(magic)) == 0;
+}
+
+// true if count elements of elementSize at offset lie inside the file and are aligned
+static bool arrayFits(uint64_t offset, uint64_t count, uint64_t elementSize, size_t fileSize)
+{
+    if (offset % kArrayAlignment != 0 || offset > fileSize)
+        return false;
+    return count <= (fileSize - offset) / elementSize;
+}
+
+bool BinaryScene::open(const std::string &fileName)
+{
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "File " << fileName << " not exist" << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(SceneHeader))
+    {
+        close(fd);
+        std::cerr << "File " << fileName << " is not a binary scene" << std::endl;
+        return false;
+    }
+    mappingSize = info.st_size;
+    mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        mapping = nullptr;
+        std::cerr << "Cannot map " << fileName << std::endl;
+        return false;
+    }
+
+    const char *base = static_cast<const char *>(mapping);
+    SceneHeader header;
+    std::memcpy(&header, base, sizeof(header));
+    if (std::memcmp(header.magic, kSceneMagic, sizeof(kSceneMagic)) != 0 || header.version != kSceneVersion)
+    {
+        std::cerr << "File " << fileName << " is not a version " << kSceneVersion << " binary scene" << std::endl;
+        return false;
+    }
+    const uint64_t n = header.sphereCount;
+    if (!arrayFits(header.centerXOffset, n, sizeof(double), mappingSize) ||
+        !arrayFits(header.centerYOffset, n, sizeof(double), mappingSize) ||
+        !arrayFits(header.centerZOffset, n, sizeof(double), mappingSize) ||
+        !arrayFits(header.radiusOffset, n, sizeof(double), mappingSize) ||
+        !arrayFits(header.materialIdOffset, n, sizeof(uint32_t), mappingSize) ||
+        !arrayFits(header.materialOffset, header.materialCount, sizeof(SceneMaterial), mappingSize))
+    {
+        std::cerr << "Binary scene " << fileName << " is truncated" << std::endl;
+        return false;
+    }
+
+    sphereCount = n;
+    materialCount = header.materialCount;
+    centerX = reinterpret_cast<const double *>(base + header.centerXOffset);
+    centerY = reinterpret_cast<const double *>(base + header.centerYOffset);
+    centerZ = reinterpret_cast<const double *>(base + header.centerZOffset);
+    radius = reinterpret_cast<const double *>(base + header.radiusOffset);
+    materialId = reinterpret_cast<const uint32_t *>(base + header.materialIdOffset);
+    materials = reinterpret_cast<const SceneMaterial *>(base + header.materialOffset);
+    return true;
+}
+
+std::vector<Sphere *> BinaryScene::spheres() const
+{
+    return spheres(0, sphereCount);
+}
+
+std::vector<Sphere *> BinaryScene::spheres(uint64_t first, uint64_t last) const
+{
+    std::vector<Sphere *> output;
+    if (!spheres(first, last, output))
+    {
+        std::cerr << "Binary scene refers to a material that does not exist" << std::endl;
+        exit(1);
+    }
+    return output;
+}
+
+bool BinaryScene::spheres(uint64_t first, uint64_t last, std::vector<Sphere *> &output) const
+{
+    last = std::min(last, sphereCount);
+    first = std::min(first, last);
+    output.assign(last - first, nullptr);
+    bool valid = true;
+#pragma omp parallel for schedule(static) reduction(&& : valid)
+    for (int64_t i = first; i < static_cast<int64_t>(last); i++)
+    {
+        uint32_t id = materialId[i];
+        if (id >= materialCount)
+        {
+            valid = false;
+            continue;
+        }
+        output[i - first] = new Sphere(vec3(centerX[i], centerY[i], centerZ[i]), radius[i], make_material(materials[id]));
+    }
+    if (!valid)
+    {
+        for (Sphere *s : output)
+            delete s;
+        output.clear();
+    }
+    return valid;
+}
+
+// GetCenter, GetRadius and GetMaterial read sphere i of the input
+template <typename GetCenter, typename GetRadius, typename GetMaterial>
+static bool writeScene(const std::string &fileName, size_t n, GetCenter center, GetRadius radius, GetMaterial getMaterial)
+{
+    std::vector<double> x(n), y(n), z(n), r(n);
+    std::vector<uint32_t> ids(n);
+    std::vector<SceneMaterial> materials;
+    // identical materials share one table entry
+    std::unordered_map<std::string, uint32_t> known;
+    for (size_t i = 0; i < n; i++)
+    {
+        vec3 c = center(i);
+        x[i] = c.x();
+        y[i] = c.y();
+        z[i] = c.z();
+        r[i] = radius(i);
+        SceneMaterial m = describe_material(getMaterial(i));
+        std::string key(reinterpret_cast<const char *>(&m), sizeof(m));
+        auto found = known.find(key);
+        if (found == known.end())
+        {
+            found = known.emplace(key, static_cast<uint32_t>(materials.size())).first;
+            materials.push_back(m);
+        }
+        ids[i] = found->second;
+    }
+
+    BinarySceneWriter writer;
+    if (!writer.open(fileName, n, materials))
+        return false;
+    writer.writeSpheres(0, n, x.data(), y.data(), z.data(), r.data(), ids.data());
+    return writer.close();
+}
+
+bool BinaryScene::write(const std::string &fileName, const std::vector<Sphere *> &spheres)
+{
+    return writeScene(
+        fileName, spheres.size(),
+        [&](size_t i) { return spheres[i]->center; },
+        [&](size_t i) { return spheres[i]->r; },
+        [&](size_t i) { return spheres[i]->mat_ptr; });
+}
+
+bool BinaryScene::write(const std::string &fileName, const std::vector<sphere *> &spheres)
+{
+    return writeScene(
+        fileName, spheres.size(),
+        [&](size_t i) { return spheres[i]->center; },
+        [&](size_t i) { return spheres[i]->radius; },
+        [&](size_t i) { return spheres[i]->mat_ptr.get(); });
+}
+
+BinarySceneWriter::~BinarySceneWriter()
+{
+    if (fd >= 0)
+        ::close(fd);
+}
+
+bool BinarySceneWriter::writeAt(uint64_t offset, const void *data, size_t size)
+{
+    const char *p = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        ssize_t written = pwrite(fd, p, size, offset);
+        if (written <= 0)
+        {
+            failed = true;
+            return false;
+        }
+        p += written;
+        offset += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool BinarySceneWriter::open(const std::string &name, uint64_t n, const std::vector<SceneMaterial> &materials)
+{
+    fileName = name;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kSceneMagic, sizeof(kSceneMagic));
+    header.version = kSceneVersion;
+    header.materialCount = materials.size();
+    header.sphereCount = n;
+    header.centerXOffset = alignUp(sizeof(header));
+    header.centerYOffset = alignUp(header.centerXOffset + n * sizeof(double));
+    header.centerZOffset = alignUp(header.centerYOffset + n * sizeof(double));
+    header.radiusOffset = alignUp(header.centerZOffset + n * sizeof(double));
+    header.materialIdOffset = alignUp(header.radiusOffset + n * sizeof(double));
+    header.materialOffset = alignUp(header.materialIdOffset + n * sizeof(uint32_t));
+    const uint64_t fileSize = header.materialOffset + materials.size() * sizeof(SceneMaterial);
+
+    // the gaps between arrays are left as holes, which read back as zeros
+    fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, fileSize) != 0)
+    {
+        std::cerr << "Cannot open " << fileName << " for writing" << std::endl;
+        return false;
+    }
+    if (!writeAt(0, &header, sizeof(header)) ||
+        !writeAt(header.materialOffset, materials.data(), materials.size() * sizeof(SceneMaterial)))
+    {
+        std::cerr << "Failed writing " << fileName << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool BinarySceneWriter::writeSpheres(uint64_t first, uint64_t n, const double *x, const double *y, const double *z,
+                                     const double *radius, const uint32_t *materialId)
+{
+    if (first + n > header.sphereCount)
+    {
+        failed = true;
+        return false;
+    }
+    return writeAt(header.centerXOffset + first * sizeof(double), x, n * sizeof(double)) &&
+           writeAt(header.centerYOffset + first * sizeof(double), y, n * sizeof(double)) &&
+           writeAt(header.centerZOffset + first * sizeof(double), z, n * sizeof(double)) &&
+           writeAt(header.radiusOffset + first * sizeof(double), radius, n * sizeof(double)) &&
+           writeAt(header.materialIdOffset + first * sizeof(uint32_t), materialId, n * sizeof(uint32_t));
+}
+
+bool BinarySceneWriter::close()
+{
+    bool ok = fd >= 0 && !failed;
+    if (fd >= 0 && ::close(fd) != 0)
+        ok = false;
+    fd = -1;
+    if (!ok)
+        std::cerr << "Failed writing " << fileName << std::endl;
+    return ok;
+}
@@ -0,0 +1,132 @@
+#ifndef _SCENE_BINARY_H_
+#define _SCENE_BINARY_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "sphere.h"
+#include "boundable.h"
+#include "material_record.h"
+
+/**
+ * Columnar binary scene, version 1. All values are little endian.
+ *
+ *   SceneHeader
+ *   double   centerX[sphereCount]     every array starts at a 64-byte aligned offset
+ *   double   centerY[sphereCount]
+ *   double   centerZ[sphereCount]
+ *   double   radius[sphereCount]
+ *   uint32_t materialId[sphereCount]  index into materials
+ *   SceneMaterial materials[materialCount]
+ *
+ * The file is mapped read-only and the arrays are used in place.
+ */
+struct SceneHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t materialCount;
+    uint64_t sphereCount;
+    uint64_t centerXOffset;
+    uint64_t centerYOffset;
+    uint64_t centerZOffset;
+    uint64_t radiusOffset;
+    uint64_t materialIdOffset;
+    uint64_t materialOffset;
+};
+
+// the material table holds material_record entries
+typedef material_record SceneMaterial;
+
+class BinaryScene
+{
+public:
+    BinaryScene() = default;
+    BinaryScene(const BinaryScene &) = delete;
+    BinaryScene &operator=(const BinaryScene &) = delete;
+    ~BinaryScene();
+
+    /**
+     * @brief map fileName and check its header. Returns false if it is not a
+     * valid binary scene.
+     */
+    bool open(const std::string &fileName);
+
+    /**
+     * @brief true if the file starts with the binary scene magic
+     */
+    static bool isBinaryScene(const std::string &fileName);
+
+    /**
+     * @brief allocate a Sphere with its own material for every entry, in parallel
+     */
+    std::vector<Sphere *> spheres() const;
+
+    /**
+     * @brief the same for entries first .. last - 1 only, the rest of the file is not read
+     */
+    std::vector<Sphere *> spheres(uint64_t first, uint64_t last) const;
+
+    /**
+     * @brief the same into output, false with output left empty if an entry refers to
+     * a material that does not exist. The variants above exit instead.
+     */
+    bool spheres(uint64_t first, uint64_t last, std::vector<Sphere *> &output) const;
+
+    static bool write(const std::string &fileName, const std::vector<Sphere *> &spheres);
+    static bool write(const std::string &fileName, const std::vector<sphere *> &spheres);
+
+    uint64_t sphereCount = 0;
+    uint32_t materialCount = 0;
+    const double *centerX = nullptr;
+    const double *centerY = nullptr;
+    const double *centerZ = nullptr;
+    const double *radius = nullptr;
+    const uint32_t *materialId = nullptr;
+    const SceneMaterial *materials = nullptr;
+
+private:
+    void *mapping = nullptr;
+    size_t mappingSize = 0;
+};
+
+/**
+ * Writes a binary scene whose sphere count and material table are known up
+ * front. The file is sized on open, so ranges of spheres can be written from
+ * several threads at once and in any order.
+ */
+class BinarySceneWriter
+{
+public:
+    BinarySceneWriter() = default;
+    BinarySceneWriter(const BinarySceneWriter &) = delete;
+    BinarySceneWriter &operator=(const BinarySceneWriter &) = delete;
+    ~BinarySceneWriter();
+
+    /**
+     * @brief create fileName and write the header and the material table
+     */
+    bool open(const std::string &fileName, uint64_t sphereCount, const std::vector<SceneMaterial> &materials);
+
+    /**
+     * @brief write spheres first .. first + n - 1 from the given columns. Thread safe.
+     */
+    bool writeSpheres(uint64_t first, uint64_t n, const double *x, const double *y, const double *z,
+                      const double *radius, const uint32_t *materialId);
+
+    /**
+     * @brief close the file. False if it or any earlier write failed.
+     */
+    bool close();
+
+private:
+    bool writeAt(uint64_t offset, const void *data, size_t size);
+
+    int fd = -1;
+    SceneHeader header;
+    std::string fileName;
+    std::atomic<bool> failed{false};
+};
+
+#endif
@@ -0,0 +1,18 @@
+#include "data_porting.h"
+#include "scene_binary.h"
+#include <iostream>
+
+// converts a scene (JSON or binary) into the binary scene format
+int main(int argc, char **argv){
+    if(argc<3){
+      std::cerr<<"Usage: "<<argv[0]<<" input.data output.scene"<<std::endl;
+      exit(1);
+    }
+    ShapeDataIO io;
+    std::vector<Sphere*> spheres = io.load_scene(argv[1]);
+    bool ok = BinaryScene::write(argv[2], spheres);
+    if(ok)
+      std::cout<<spheres.size()<<" spheres written to "<<argv[2]<<std::endl;
+    io.clear_scene(spheres);
+    return ok ? 0 : 1;
+}
@@ -1,25 +1,44 @@
-#include "data_porting.h"
-#include "hittable_list.h"
-#include "hittable.h"
-#include "material.h"
-#include "sphere.h"
 #include "common.h"
-#include <nlohmann/json.hpp>
+#include <iostream>
+#include <string>
+#include "options.h"
 #include "sphere_generation.h"
 
+static void usage(const char *program){
+    std::cerr<<"Usage: "<<program<<" size|--count=n [--distribution=random_scene|grid|uniform|clustered|multiscale]"
+             <<" [--seed=s] [--extent=e] [--clusters=k] [--threads=t] [--binary] [--output=file]"<<std::endl;
+    exit(1);
+}
+
+// a missing option keeps value, a malformed one prints the usage
+static void get_count(const options &opts, const std::string &name, uint64_t &value, const char *program){
+    if(opts.has(name) && !SphereGeneration::parse_count(opts.get(name, ""), value))
+      usage(program);
+}
+
 int main(int argc, char **argv){
-    if(argc<2){
-      std::cerr<<"Usage: "<<argv[0]<<" size"<<std::endl;
+    options opts(argc, argv);
+    if(opts.positional().empty() && !opts.has("count"))
+      usage(argv[0]);
+    SceneGenerationParams params;
+    if(!SphereGeneration::parse_distribution(opts.get("distribution", "random_scene"), params.distribution)){
+      std::cerr<<"Unknown distribution "<<opts.get("distribution", "")<<std::endl;
       exit(1);
     }
-    int size = atoi(argv[1]);
-    ShapeDataIO io;
-    SphereGeneration sg;
-    auto spheres = sg.random_scene_spheres(size);
-    nlohmann::json spheresJson = io.serialize(spheres);
-    io.write("random_spheres_scene.data", spheresJson);
-    auto readJson = io.read("random_spheres_scene.data");
-    auto readSpheres = io.deserialize_Spheres(readJson);
-    std::cout<<readSpheres.size()<<" records are generated."<<std::endl;
+    // size keeps the sphere count of the old random_scene generator
+    uint64_t size = 0;
+    if(!opts.positional().empty() && !SphereGeneration::parse_count(opts.positional()[0], size))
+      usage(argv[0]);
+    params.count = SphereGeneration::grid_count(params.distribution, size);
+    get_count(opts, "count", params.count, argv[0]);
+    get_count(opts, "seed", params.seed, argv[0]);
+    params.extent = opts.get_double("extent", 0);
+    params.clusters = opts.get_int("clusters", params.clusters);
+    params.threads = opts.get_int("threads", 0);
+    bool binary = opts.has("binary");
+    std::string fileName = opts.get("output", binary ? "random_spheres_scene.scene" : "random_spheres_scene.data");
+    if(!SphereGeneration::write_scene(fileName, params, binary))
+      exit(1);
+    std::cout<<params.count<<" records are generated."<<std::endl;
     return 0;
-}
\ No newline at end of file
+}
@@ -1,6 +1,15 @@
 #include "sphere_generation.h"
 #include "hittable_list.h"
 #include "boundable.h"
+#include "scene_binary.h"
+#include <omp.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
 
 hittable_list SphereGeneration::random_scene_hittablelist(int size)
 {
@@ -169,5 +178,432 @@ std::vector<Sphere*> SphereGeneration::random_scene_Spheres(int size)
   return output;
 }
 
+namespace
+{
+const uint64_t kPaletteSize = 1024;
+const uint64_t kBlockSize = 1 << 16;
+// disjoint stream ranges of the per-seed generator
+const uint64_t kPaletteStream = 1ULL << 63;
+const uint64_t kClusterStream = 1ULL << 62;
+
+// the ground and the three big spheres of random_scene_*, with their materials
+// appended to the palette; the ground comes first and the others last
+const int kFixedSpheres = 4;
+const double kFixedSphere[kFixedSpheres][4] = {
+    {0, -1000, 0, 1000}, {0, 1, 0, 1}, {-4, 1, 0, 1}, {4, 1, 0, 1}};
+// radius of the clearing in the grid around the metal sphere
+const double kClearing = 0.9;
+
+uint64_t mix64(uint64_t z)
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// splitmix64 sequence number `stream` of a seed, cheap to start anywhere
+class scene_random
+{
+public:
+  scene_random(uint64_t seed, uint64_t stream) : state(mix64(seed ^ mix64(stream + 0x9e3779b97f4a7c15ULL))) {}
+
+  uint64_t next()
+  {
+    state += 0x9e3779b97f4a7c15ULL;
+    return mix64(state);
+  }
+  double uniform() { return (next() >> 11) * 0x1.0p-53; }
+  double uniform(double min, double max) { return min + (max - min) * uniform(); }
+  double gaussian()
+  {
+    double u1 = 1.0 - uniform();
+    double u2 = uniform();
+    return std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * pi * u2);
+  }
+
+private:
+  uint64_t state;
+};
+
+struct generated_sphere
+{
+  double x, y, z, radius;
+  uint32_t material;
+};
+
+class scene_generator
+{
+public:
+  explicit scene_generator(const SceneGenerationParams &p) : params(p)
+  {
+    extent = p.extent > 0 ? p.extent : std::max(1.0, std::cbrt(static_cast<double>(p.count)));
+    uint64_t cells = p.count;
+    if (p.distribution == SceneDistribution::random_scene)
+      cells = p.count > kFixedSpheres ? p.count - kFixedSpheres : 0;
+    side = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(std::sqrt(static_cast<double>(cells)))));
+
+    // same mix of materials as random_scene_*
+    for (uint64_t m = 0; m < kPaletteSize; m++)
+      {
+        scene_random rng(p.seed, kPaletteStream | m);
+        SceneMaterial entry;
+        std::memset(&entry, 0, sizeof(entry));
+        double choose = rng.uniform();
+        if (choose < 0.8)
+          {
+            entry.type = material_lambertian;
+            for (int c = 0; c < 3; c++)
+              entry.albedo[c] = rng.uniform() * rng.uniform();
+          }
+        else if (choose < 0.95)
+          {
+            entry.type = material_metal;
+            for (int c = 0; c < 3; c++)
+              entry.albedo[c] = rng.uniform(0.5, 1);
+            entry.parameter = rng.uniform(0, 0.5);
+          }
+        else
+          {
+            entry.type = material_dielectric;
+            entry.parameter = 1.5;
+          }
+        palette.push_back(entry);
+      }
+    if (p.distribution == SceneDistribution::random_scene)
+      {
+        SceneMaterial fixed[kFixedSpheres];
+        std::memset(fixed, 0, sizeof(fixed));
+        fixed[0].type = material_lambertian;
+        fixed[0].albedo[0] = fixed[0].albedo[1] = fixed[0].albedo[2] = 0.5;
+        fixed[1].type = material_dielectric;
+        fixed[1].parameter = 1.5;
+        fixed[2].type = material_lambertian;
+        fixed[2].albedo[0] = 0.4;
+        fixed[2].albedo[1] = 0.2;
+        fixed[2].albedo[2] = 0.1;
+        fixed[3].type = material_metal;
+        fixed[3].albedo[0] = 0.7;
+        fixed[3].albedo[1] = 0.6;
+        fixed[3].albedo[2] = 0.5;
+        palette.insert(palette.end(), fixed, fixed + kFixedSpheres);
+      }
+
+    int clusters = std::max(1, p.clusters);
+    for (int k = 0; k < clusters; k++)
+      {
+        scene_random rng(p.seed, kClusterStream | k);
+        clusterCenters.push_back(vec3(rng.uniform(-extent, extent), rng.uniform(-extent, extent),
+                                      rng.uniform(-extent, extent)));
+      }
+    clusterSigma = extent / std::cbrt(static_cast<double>(clusters)) / 2;
+  }
+
+  generated_sphere operator()(uint64_t i) const
+  {
+    scene_random rng(params.seed, i);
+    generated_sphere s;
+    s.material = rng.next() % kPaletteSize;
+    s.radius = 0.2;
+    switch (params.distribution)
+      {
+      case SceneDistribution::grid:
+        grid_sphere(i, rng, s);
+        break;
+      case SceneDistribution::random_scene:
+        {
+          if (i == 0 || i + kFixedSpheres > params.count)
+            {
+              int fixed = i == 0 ? 0 : static_cast<int>(i + kFixedSpheres - params.count);
+              s.x = kFixedSphere[fixed][0];
+              s.y = kFixedSphere[fixed][1];
+              s.z = kFixedSphere[fixed][2];
+              s.radius = kFixedSphere[fixed][3];
+              s.material = kPaletteSize + fixed;
+              break;
+            }
+          // the grid is kept clear around the metal sphere; random_scene_* drops
+          // the spheres that land there, here they move out to the clearing's
+          // rim so that every index still holds a sphere
+          grid_sphere(i - 1, rng, s);
+          vec3 offset(s.x - 4, 0, s.z);
+          double distance = offset.length();
+          if (distance <= kClearing)
+            {
+              offset = distance > 0 ? offset / distance : vec3(1, 0, 0);
+              s.x = 4 + offset.x() * kClearing * (1 + 1e-9);
+              s.z = offset.z() * kClearing * (1 + 1e-9);
+            }
+          break;
+        }
+      case SceneDistribution::clustered:
+        {
+          const vec3 &c = clusterCenters[rng.next() % clusterCenters.size()];
+          s.x = c.x() + clusterSigma * rng.gaussian();
+          s.y = c.y() + clusterSigma * rng.gaussian();
+          s.z = c.z() + clusterSigma * rng.gaussian();
+          break;
+        }
+      case SceneDistribution::multiscale:
+        {
+          // mostly small spheres and a few up to a sixteenth of the extent
+          double minRadius = 0.05, maxRadius = std::max(minRadius, extent / 16);
+          s.radius = minRadius * std::pow(maxRadius / minRadius, std::pow(rng.uniform(), 4));
+        }
+        // fall through
+      case SceneDistribution::uniform:
+        s.x = rng.uniform(-extent, extent);
+        s.y = rng.uniform(-extent, extent);
+        s.z = rng.uniform(-extent, extent);
+        break;
+      }
+    return s;
+  }
+
+  SceneGenerationParams params;
+  std::vector<SceneMaterial> palette;
+
+private:
+  // sphere in cell `cell` of the jittered grid, cells counted along z first
+  void grid_sphere(uint64_t cell, scene_random &rng, generated_sphere &s) const
+  {
+    double half = side / 2.0;
+    s.x = (cell / side) - half + 0.9 * rng.uniform();
+    s.y = 0.2;
+    s.z = (cell % side) - half + 0.9 * rng.uniform();
+  }
+
+  double extent;
+  uint64_t side;
+  std::vector<vec3> clusterCenters;
+  double clusterSigma;
+};
+
+void append_number(std::string &out, double value)
+{
+  char buffer[32];
+  int n = snprintf(buffer, sizeof(buffer), "%.17g", value);
+  out.append(buffer, n);
+}
+
+// the "material" object as ShapeDataIO::serialize writes it
+std::string material_json(const SceneMaterial &m)
+{
+  std::string out = "{";
+  if (m.type != material_dielectric)
+    {
+      out += "\"color\":{\"b\":";
+      append_number(out, m.albedo[2]);
+      out += ",\"g\":";
+      append_number(out, m.albedo[1]);
+      out += ",\"r\":";
+      append_number(out, m.albedo[0]);
+      out += "},";
+    }
+  if (m.type == material_metal)
+    {
+      out += "\"fuzz\":";
+      append_number(out, m.parameter);
+      out += ",\"type\":\"metal\"}";
+    }
+  else if (m.type == material_dielectric)
+    {
+      out += "\"refraction_index\":";
+      append_number(out, m.parameter);
+      out += ",\"type\":\"dielectric\"}";
+    }
+  else
+    out += "\"type\":\"lambertian\"}";
+  return out;
+}
+
+bool write_json(const std::string &fileName, const scene_generator &generate, int threads)
+{
+  FILE *file = fopen(fileName.c_str(), "wb");
+  if (file == nullptr)
+    {
+      std::cerr << "Cannot open " << fileName << " for writing" << std::endl;
+      return false;
+    }
+  std::vector<std::string> materials;
+  for (const SceneMaterial &m : generate.palette)
+    materials.push_back(material_json(m));
+
+  const uint64_t count = generate.params.count;
+  const uint64_t blocks = (count + kBlockSize - 1) / kBlockSize;
+  // a few blocks per thread are formatted in parallel, then written in order
+  std::vector<std::string> text(4 * threads);
+  bool ok = fputs("{\"spheres\":[\n", file) >= 0;
+  for (uint64_t first = 0; first < blocks && ok; first += text.size())
+    {
+      const int64_t n = std::min<uint64_t>(text.size(), blocks - first);
+#pragma omp parallel for schedule(dynamic) num_threads(threads)
+      for (int64_t b = 0; b < n; b++)
+        {
+          std::string &out = text[b];
+          out.clear();
+          uint64_t end = std::min(count, (first + b + 1) * kBlockSize);
+          for (uint64_t i = (first + b) * kBlockSize; i < end; i++)
+            {
+              generated_sphere s = generate(i);
+              out += "{\"sphere\":{\"location\":{\"x\":";
+              append_number(out, s.x);
+              out += ",\"y\":";
+              append_number(out, s.y);
+              out += ",\"z\":";
+              append_number(out, s.z);
+              out += "},\"material\":";
+              out += materials[s.material];
+              out += ",\"radius\":";
+              append_number(out, s.radius);
+              out += i + 1 < count ? "}},\n" : "}}\n";
+            }
+        }
+      for (int64_t b = 0; b < n && ok; b++)
+        ok = fwrite(text[b].data(), 1, text[b].size(), file) == text[b].size();
+    }
+  ok = fputs("]}\n", file) >= 0 && ok;
+  ok = fclose(file) == 0 && ok;
+  if (!ok)
+    std::cerr << "Failed writing " << fileName << std::endl;
+  return ok;
+}
+
+bool write_binary(const std::string &fileName, const scene_generator &generate, int threads)
+{
+  const uint64_t count = generate.params.count;
+  BinarySceneWriter writer;
+  if (!writer.open(fileName, count, generate.palette))
+    return false;
+  const int64_t blocks = (count + kBlockSize - 1) / kBlockSize;
+#pragma omp parallel num_threads(threads)
+  {
+    std::vector<double> x(kBlockSize), y(kBlockSize), z(kBlockSize), r(kBlockSize);
+    std::vector<uint32_t> ids(kBlockSize);
+#pragma omp for schedule(dynamic)
+    for (int64_t b = 0; b < blocks; b++)
+      {
+        uint64_t first = b * kBlockSize;
+        uint64_t n = std::min(kBlockSize, count - first);
+        for (uint64_t k = 0; k < n; k++)
+          {
+            generated_sphere s = generate(first + k);
+            x[k] = s.x;
+            y[k] = s.y;
+            z[k] = s.z;
+            r[k] = s.radius;
+            ids[k] = s.material;
+          }
+        writer.writeSpheres(first, n, x.data(), y.data(), z.data(), r.data(), ids.data());
+      }
+  }
+  return writer.close();
+}
+} // namespace
+
+bool SphereGeneration::parse_distribution(const std::string &name, SceneDistribution &distribution)
+{
+  if (name == "grid")
+    distribution = SceneDistribution::grid;
+  else if (name == "random_scene")
+    distribution = SceneDistribution::random_scene;
+  else if (name == "uniform")
+    distribution = SceneDistribution::uniform;
+  else if (name == "clustered")
+    distribution = SceneDistribution::clustered;
+  else if (name == "multiscale")
+    distribution = SceneDistribution::multiscale;
+  else
+    return false;
+  return true;
+}
+
+uint64_t SphereGeneration::grid_count(SceneDistribution distribution, uint64_t size)
+{
+  return 4 * size * size + (distribution == SceneDistribution::random_scene ? kFixedSpheres : 0);
+}
 
+bool SphereGeneration::write_scene(const std::string &fileName, const SceneGenerationParams &params, bool binary)
+{
+  scene_generator generate(params);
+  int threads = params.threads > 0 ? params.threads : omp_get_max_threads();
+  return binary ? write_binary(fileName, generate, threads) : write_json(fileName, generate, threads);
+}
 
+bool SphereGeneration::parse_count(const std::string &text, uint64_t &value)
+{
+  // strtoull would accept a sign and wrap negative numbers around
+  if (text.empty() || !isdigit(static_cast<unsigned char>(text[0])))
+    return false;
+  char *end = nullptr;
+  errno = 0;
+  value = strtoull(text.c_str(), &end, 10);
+  return *end == '\0' && errno != ERANGE;
+}
+
+bool SphereGeneration::is_spec(const std::string &scene)
+{
+  return scene.compare(0, 4, "gen:") == 0;
+}
+
+bool SphereGeneration::parse_spec(const std::string &spec, SceneGenerationParams &params)
+{
+  if (!is_spec(spec))
+    return false;
+  std::vector<std::string> fields;
+  size_t start = 4;
+  while (start <= spec.size())
+    {
+      size_t comma = std::min(spec.find(',', start), spec.size());
+      fields.push_back(spec.substr(start, comma - start));
+      start = comma + 1;
+    }
+  if (!parse_distribution(fields[0], params.distribution))
+    return false;
+  for (size_t f = 1; f < fields.size(); f++)
+    {
+      size_t eq = fields[f].find('=');
+      if (eq == std::string::npos)
+        return false;
+      std::string name = fields[f].substr(0, eq), value = fields[f].substr(eq + 1);
+      uint64_t number = 0;
+      char *end = nullptr;
+      if (name == "count" && parse_count(value, number))
+        params.count = number;
+      else if (name == "size" && parse_count(value, number))
+        params.count = grid_count(params.distribution, number);
+      else if (name == "seed" && parse_count(value, number))
+        params.seed = number;
+      else if (name == "clusters" && parse_count(value, number) && number > 0)
+        params.clusters = number;
+      else if (name == "extent")
+        {
+          params.extent = strtod(value.c_str(), &end);
+          if (value.empty() || *end != '\0')
+            return false;
+        }
+      else
+        return false;
+    }
+  return params.count > 0;
+}
+
+std::vector<Sphere*> SphereGeneration::generate_Spheres(const SceneGenerationParams &params)
+{
+  return generate_Spheres(params, 0, params.count);
+}
+
+std::vector<Sphere*> SphereGeneration::generate_Spheres(const SceneGenerationParams &params, uint64_t first, uint64_t last)
+{
+  scene_generator generate(params);
+  last = std::min(last, params.count);
+  first = std::min(first, last);
+  std::vector<Sphere*> output(last - first, nullptr);
+  int threads = params.threads > 0 ? params.threads : omp_get_max_threads();
+#pragma omp parallel for schedule(static) num_threads(threads)
+  for (int64_t i = first; i < static_cast<int64_t>(last); i++)
+    {
+      generated_sphere s = generate(i);
+      output[i - first] = new Sphere(point3(s.x, s.y, s.z), s.radius, make_material(generate.palette[s.material]));
+    }
+  return output;
+}
@@ -4,6 +4,29 @@
 #include "sphere.h"
 #include "boundable.h"
 #include "hittable_list.h"
+#include <cstdint>
+#include <string>
+
+enum class SceneDistribution
+{
+    grid,         // the jittered ground grid of random_scene_*, without the ground and the three big spheres
+    random_scene, // the scene of random_scene_*: the ground, the grid with its clearing and the three big spheres
+    uniform,      // uniform in a cube
+    clustered,    // gaussian clusters around random centers
+    multiscale    // uniform in a cube, radii from a heavy tailed distribution
+};
+
+// Every sphere is a pure function of (seed, index), so a scene does not
+// depend on the number of threads that generated it.
+struct SceneGenerationParams
+{
+    SceneDistribution distribution = SceneDistribution::grid;
+    uint64_t count = 0;
+    uint64_t seed = 1;
+    double extent = 0;  // half width of the populated cube, 0 derives it from count
+    int clusters = 64;  // clustered only
+    int threads = 0;    // 0 uses all OpenMP threads
+};
 
 class SphereGeneration
 {
@@ -11,5 +34,24 @@ class SphereGeneration
     hittable_list random_scene_hittablelist(int size);
     std::vector<sphere*> random_scene_spheres(int size);
     std::vector<Sphere*> random_scene_Spheres(int size);
+
+    // grid, random_scene, uniform, clustered or multiscale
+    static bool parse_distribution(const std::string &name, SceneDistribution &distribution);
+    // spheres of a (2 size)^2 grid, with the four fixed spheres of random_scene
+    static uint64_t grid_count(SceneDistribution distribution, uint64_t size);
+    // Procedural scene specs stand in for a scene file, e.g.
+    // gen:clustered,count=1000000,seed=3. After the distribution come optional
+    // count, size (count = grid_count(size)), seed, extent and clusters.
+    static bool is_spec(const std::string &scene);
+    // a non-negative decimal number, as the count, size and seed fields take
+    static bool parse_count(const std::string &text, uint64_t &value);
+    static bool parse_spec(const std::string &spec, SceneGenerationParams &params);
+    // Generates the scene in parallel and streams it to fileName as JSON or as a
+    // binary scene, without holding it in memory.
+    static bool write_scene(const std::string &fileName, const SceneGenerationParams &params, bool binary);
+    // The same scene built in memory by all threads, one material per sphere.
+    static std::vector<Sphere*> generate_Spheres(const SceneGenerationParams &params);
+    // Spheres first .. last - 1 of that scene only.
+    static std::vector<Sphere*> generate_Spheres(const SceneGenerationParams &params, uint64_t first, uint64_t last);
 };
 #endif
\ No newline at end of file
@@ -10,6 +10,8 @@
 #include <cassert>
 #include "sphere_generation.h"
 #include "ray_tracing.h"
+#include "image_io.h"
+#include "options.h"
 
 hittable_list static_scene()
 {
@@ -28,8 +30,9 @@ hittable_list static_scene()
   return world;
 }
 
-int main()
+int main(int argc, char **argv)
 {
+  options opts(argc, argv);
 
   SphereGeneration scene_generator;
   // World
@@ -44,17 +47,13 @@ int main()
 
   color *output_image = new color[image_height * image_width];
   traceConfig config(cam, image_width, image_height, max_depth, samples_per_pixel,1,0,1);
-
-
-  std ::cout << "P3\n"
-             << image_width << ' ' << image_height << "\n255\n";
+  output_options(opts, config.output);
 
   double tstart = omp_get_wtime();
   raytracing_hittablelist(config, world);
   double tend = omp_get_wtime();
 
-  for (int i = 0; i < image_height * image_width; i++)
-    write_color(std::cout, output_image[i], samples_per_pixel);
+  write_image(config.output, output_image, image_width, image_height, samples_per_pixel);
 
   std::cerr << "\n\nElapsed time: " << tend - tstart << "\n";
   std::cerr << "\nDone.\n";